@@ -0,0 +1,324 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include <wayland-client.h>
+#include "simple.h"
+
+/*
+ * Kernel benchmarks.
+ *
+ * Times full frame renders of each pixel kernel at a few sizes and thread
+ * counts and writes one JSON object per line, e.g.
+ *
+ *   {"kernel":"brot","width":1920,"height":1080,"threads":4,"frames":10,
+ *    "median_ms":12.345,"p99_ms":13.1,"mpix_per_s":167.9,
+ *    "gb_per_s":0.672,"bytes_per_cycle":0.224}
+ *
+ * Frames are rendered into shm, as for a window. gb_per_s and
+ * bytes_per_cycle are the pixel bytes written per second and per
+ * timestamp counter tick (0 where there is none) of the median frame.
+ * The colour kernel only colours a ready count plane and fill only
+ * memsets rows, so on large buffers these show how close the store path
+ * gets to memory bandwidth.
+ *
+ * Both demos are benched whichever --renderer picks, through their
+ * kernels rather than their renderers: the mandelbrot renderer only
+ * colours counts brot_progress() has iterated.
+ */
+
+struct bench_job {
+        const struct canvas *canvas;
+        const double *xs;
+        double max_yy;
+        void (*band)(const struct bench_job *job, int32_t y0, int32_t y1);
+        brot_span_fn span;              /* For the mandelbrot kernels */
+        uint16_t *counts;               /* Count plane for the colour kernel */
+};
+
+static double row_y(const struct bench_job *job, int32_t y)
+{
+        return (2.0 * (double)y / (double)job->canvas->height - 1.0) * job->max_yy;
+}
+
+static struct pixel *row_data(const struct bench_job *job, int32_t y)
+{
+        return (struct pixel *)((char *)job->canvas->data + y * job->canvas->stride);
+}
+
+static void band_brot(const struct bench_job *job, int32_t y0, int32_t y1)
+{
+        uint16_t counts[job->canvas->width];
+
+        for (; y0 < y1; y0++) {
+                job->span(counts, job->canvas->width, job->xs, row_y(job, y0));
+                brot_colour_span(row_data(job, y0), counts, job->canvas->width);
+        }
+}
+
+static void band_counts(const struct bench_job *job, int32_t y0, int32_t y1)
+{
+        for (; y0 < y1; y0++)
+                job->span(&job->counts[(size_t)y0 * job->canvas->width],
+                          job->canvas->width, job->xs, row_y(job, y0));
+}
+
+static void band_colour(const struct bench_job *job, int32_t y0, int32_t y1)
+{
+        for (; y0 < y1; y0++)
+                brot_colour_span(row_data(job, y0),
+                                 &job->counts[(size_t)y0 * job->canvas->width],
+                                 job->canvas->width);
+}
+
+static void band_fill(const struct bench_job *job, int32_t y0, int32_t y1)
+{
+        for (; y0 < y1; y0++)
+                memset(row_data(job, y0), 0xff, job->canvas->width * sizeof(struct pixel));
+}
+
+static void band_brot_scalar(const struct bench_job *job, int32_t y0, int32_t y1)
+{
+        int32_t x;
+
+        for (; y0 < y1; y0++)
+                for (x = 0; x < job->canvas->width; x++)
+                        paint_brot_pixel(&row_data(job, y0)[x], job->xs[x], row_y(job, y0));
+}
+
+static void band_meta(const struct bench_job *job, int32_t y0, int32_t y1)
+{
+        struct meta_tile tile;
+        int32_t tx, tx_end, y;
+
+        meta_tile_alloc(&tile);
+
+        for (tx = 0; tx < job->canvas->width; tx += META_TILE) {
+                tx_end = tx + META_TILE;
+                if (tx_end > job->canvas->width)
+                        tx_end = job->canvas->width;
+                meta_tile_init(&tile, job->xs[tx], row_y(job, y0),
+                               job->xs[tx_end - 1], row_y(job, y1 - 1));
+                for (y = y0; y < y1; y++)
+                        meta_paint_span(&tile, row_data(job, y), tx, tx_end,
+                                        job->xs, row_y(job, y));
+        }
+        meta_tile_free(&tile);
+}
+
+static void band_meta_scalar(const struct bench_job *job, int32_t y0, int32_t y1)
+{
+        int32_t x;
+
+        for (; y0 < y1; y0++)
+                for (x = 0; x < job->canvas->width; x++)
+                        paint_meta_pixel(&row_data(job, y0)[x], job->xs[x], row_y(job, y0));
+}
+
+static const struct bench_kernel {
+        const char *name;
+        void (*band)(const struct bench_job *job, int32_t y0, int32_t y1);
+        int balls;                      /* Metaballs to move each frame, 0 for none */
+        enum brot_precision precision;
+        int counts;                     /* Needs a count plane iterated first */
+        int once;                       /* Too slow for more than the first size on one thread */
+} bench_kernels[] = {
+        { "brot",        band_brot,        0, BROT_DOUBLE },
+        { "brot_float",  band_brot,        0, BROT_FLOAT },
+        { "brot_fixed",  band_brot,        0, BROT_FIXED },
+        { "brot_scalar", band_brot_scalar, 0, BROT_DOUBLE },
+        { "meta",        band_meta,        META_BALLS },
+        { "meta_scalar", band_meta_scalar, META_BALLS },
+        { "meta_1000",   band_meta,        1000 },
+        { "meta_scalar_1000", band_meta_scalar, 1000, 0, 0, 1 },
+        { "colour",      band_colour,      0, BROT_DOUBLE, 1 },
+        { "fill",        band_fill,        0 },
+};
+
+static const struct { int32_t width, height; } bench_sizes[] = {
+        {  640,  480 },
+        { 1280,  720 },
+        { 1920, 1080 },
+};
+
+static void bench_band(void *data, int band)
+{
+        const struct bench_job *job = data;
+        int32_t y0 = band * BAND_ROWS;
+        int32_t y1 = y0 + BAND_ROWS;
+
+        if (y1 > job->canvas->height)
+                y1 = job->canvas->height;
+        job->band(job, y0, y1);
+}
+
+static double elapsed_ms(const struct timespec *start, const struct timespec *end)
+{
+        return (end->tv_sec - start->tv_sec) * 1e3
+                + (end->tv_nsec - start->tv_nsec) / 1e6;
+}
+
+/* Timestamp counter, 0 if there isn't one. */
+static uint64_t ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return 0;
+#endif
+}
+
+static int double_compare(const void *a_, const void *b_)
+{
+        double a = *(const double *)a_, b = *(const double *)b_;
+
+        return (a > b) - (a < b);
+}
+
+static void bench_one(FILE *out, const struct bench_kernel *kernel,
+                      int32_t width, int32_t height,
+                      int threads, int frames)
+{
+        struct worker_pool *workers;
+        struct canvas canvas;
+        struct shm shm;
+        struct bench_job job;
+        struct damage damage;
+        struct timespec start, end;
+        double max_xx, *xs, *times, *cycles, median, p99, bytes;
+        uint64_t t0;
+        int32_t x;
+        int frame, p;
+
+        canvas.width = width;
+        canvas.height = height;
+        canvas.stride = (width * 4 + CACHE_LINE - 1) & ~(CACHE_LINE - 1);
+        shm_create(&shm, (size_t)canvas.stride * height);
+        canvas.data = shm.data;
+        xs = malloc(width * sizeof *xs);
+        times = malloc(frames * sizeof *times);
+        cycles = malloc(frames * sizeof *cycles);
+        job.counts = kernel->counts ? malloc((size_t)width * height * sizeof *job.counts) : NULL;
+        if (!xs || !times || !cycles || (kernel->counts && !job.counts)) {
+                perror("Bench setup failed");
+                exit(1);
+        }
+
+        viewport_extents(width, height, &max_xx, &job.max_yy);
+        for (x = 0; x < width; x++)
+                xs[x] = (2.0 * (double)x / (double)width - 1.0) * max_xx;
+        job.canvas = &canvas;
+        job.xs = xs;
+        job.band = kernel->band;
+        job.span = brot_spans[kernel->precision];
+
+        workers = worker_pool_create(threads);
+        if (kernel->counts) {
+                job.band = band_counts;
+                worker_pool_run(workers, (height + BAND_ROWS - 1) / BAND_ROWS,
+                                bench_band, &job);
+                job.band = kernel->band;
+        }
+        if (kernel->balls) {
+                if (global_balls.n != kernel->balls) {
+                        meta_renderer.destroy();
+                        meta_balls = kernel->balls;
+                        meta_renderer.init();
+                }
+                srand(1);
+                meta_update(1, &damage, width, height, max_xx, job.max_yy);
+        }
+
+        for (frame = 0; frame < frames; frame++) {
+                clock_gettime(CLOCK_MONOTONIC, &start);
+                t0 = ticks();
+                if (kernel->balls)
+                        meta_update(0, &damage, width, height, max_xx, job.max_yy);
+                worker_pool_run(workers, (height + BAND_ROWS - 1) / BAND_ROWS,
+                                bench_band, &job);
+                cycles[frame] = ticks() - t0;
+                clock_gettime(CLOCK_MONOTONIC, &end);
+                times[frame] = elapsed_ms(&start, &end);
+        }
+
+        qsort(times, frames, sizeof *times, double_compare);
+        qsort(cycles, frames, sizeof *cycles, double_compare);
+        median = times[frames / 2];
+        p = (frames * 99 + 99) / 100 - 1;
+        p99 = times[p < frames ? p : frames - 1];
+        bytes = (double)width * height * sizeof(struct pixel);
+
+        fprintf(out, "{\"kernel\":\"%s\",\"width\":%d,\"height\":%d,"
+                "\"threads\":%d,\"frames\":%d,\"median_ms\":%.3f,"
+                "\"p99_ms\":%.3f,\"mpix_per_s\":%.1f,"
+                "\"gb_per_s\":%.3f,\"bytes_per_cycle\":%.3f}\n",
+                kernel->name, width, height, threads, frames,
+                median, p99, (double)width * height / (median * 1e3),
+                bytes / (median * 1e6),
+                cycles[frames / 2] > 0 ? bytes / cycles[frames / 2] : 0.0);
+        fflush(out);
+
+        worker_pool_destroy(workers);
+        free(job.counts);
+        free(cycles);
+        free(times);
+        free(xs);
+        shm_destroy(&shm);
+}
+
+/**
+ * Run every kernel at every size with 1, 2, 4... up to one thread per
+ * CPU, frames renders each, and write results to path ("-" for stdout).
+ * Kernels marked once only run at the first size on one thread.
+ */
+int bench_run(const char *path, int frames)
+{
+        FILE *out;
+        int k, s, threads, cpus;
+
+        if (frames <= 0)
+                frames = 1;
+
+        out = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+        if (!out) {
+                perror(path);
+                return 1;
+        }
+
+        cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        if (cpus < 1)
+                cpus = 1;
+
+        brot_renderer.init();
+        meta_renderer.init();
+        palette_update();
+
+        for (k = 0; k < sizeof bench_kernels / sizeof bench_kernels[0]; k++) {
+                for (s = 0; s < sizeof bench_sizes / sizeof bench_sizes[0]; s++) {
+                        if (s > 0 && bench_kernels[k].once)
+                                break;
+                        for (threads = 1; ; threads *= 2) {
+                                if (threads > cpus)
+                                        threads = cpus;
+                                bench_one(out, &bench_kernels[k],
+                                          bench_sizes[s].width, bench_sizes[s].height,
+                                          threads, frames);
+                                if (threads == cpus || bench_kernels[k].once)
+                                        break;
+                        }
+                }
+        }
+
+        brot_renderer.destroy();
+        meta_renderer.destroy();
+        if (out != stdout)
+                fclose(out);
+        return 0;
+}
@@ -0,0 +1,643 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BROT_X86
+#endif
+
+#include <wayland-client.h>
+#include "simple.h"
+
+/*
+ * Mandelbrot escape-time kernels.
+ *
+ * The kernels only count iterations, into a plane of uint16_t, and
+ * colouring is a separate pass through the palette (see palette.c), so a
+ * new palette costs a pass over memory instead of iterating again.
+ *
+ * paint_brot_pixel() is the reference. The vector kernels run the same
+ * recurrence on a 16, 32 or 64 byte vector (SSE2, AVX2, AVX-512) of
+ * pixels at once, a lane stops counting once it escapes but keeps
+ * iterating with the others until every lane has escaped or hit
+ * brot_max_iter. They are generated from brot_span.h in float, fixed
+ * point and double, and brot_precision() picks the fastest one a view
+ * can use.
+ *
+ * Points in the main cardioid or the period-2 bulb never escape, so they
+ * are coloured without iterating. Other interior points are caught by
+ * Brent-style periodicity checking: z is compared against a reference
+ * point that moves up to the current z at every power of two iterations,
+ * and an orbit that lands back on it exactly is periodic and never
+ * escapes. Without these interior points always cost the full
+ * brot_max_iter, which is what kept it low.
+ *
+ * Every double kernel performs the exact same IEEE operations in the same
+ * order as the scalar loop (the Makefile builds with -ffp-contract=off so
+ * none get fused into FMAs) and so produces bit-identical output. So do
+ * the float and the fixed point kernels, among themselves.
+ */
+
+#define SQR(_X) ((_X)*(_X))
+
+int brot_max_iter = BROT_MAX_ITER;
+
+/**
+ * The plain palette: escaping points shade from clear to black with the
+ * number of iterations they took, points inside the set are white.
+ */
+void brot_colour(struct pixel *pixel, int i)
+{
+        if (i < brot_max_iter) {
+                pixel->a = ((double)i/(double)brot_max_iter) * 255;
+                pixel->r = 0;
+                pixel->g = 0;
+                pixel->b = 0;
+        } else {
+                pixel->a = 255;
+                pixel->r = 255;
+                pixel->g = 255;
+                pixel->b = 255;
+        }
+}
+
+/* In the main cardioid or the period-2 bulb, which never escape. */
+static inline int brot_interior(double x0, double y0)
+{
+        double xq = x0 - 0.25;
+        double q = SQR(xq) + SQR(y0);
+        double xp = x0 + 1.0;
+
+        return q * (q + xq) <= 0.25 * SQR(y0)
+                || SQR(xp) + SQR(y0) <= 0.0625;
+}
+
+/* The iteration count of paint_brot_pixel(). */
+static inline int brot_count(double x, double y)
+{
+        double x0 = x / 2;
+        double y0 = y / 2;
+
+        double zx = 0;
+        double zy = 0;
+        int i = 0;
+
+        /* Periodicity reference point, moved at iteration next. */
+        double ox = 0;
+        double oy = 0;
+        int next = 1;
+
+        if (brot_interior(x0, y0))
+                return brot_max_iter;
+
+        while ( SQR(zx) + SQR(zy) < 4.0
+                && i < brot_max_iter) {
+
+                double xtemp = SQR(zx) - SQR(zy)  + x0;
+                zy = 2*zx*zy + y0;
+                zx = xtemp;
+                i++;
+
+                if (zx == ox && zy == oy)
+                        return brot_max_iter;
+                if (i == next) {
+                        ox = zx;
+                        oy = zy;
+                        next *= 2;
+                }
+        }
+
+        return i;
+}
+
+static void brot_span_scalar(uint16_t *counts, int32_t n,
+                             const double *xs, double y)
+{
+        int32_t x;
+
+        for (x = 0; x < n; x++)
+                counts[x] = brot_count(xs[x], y);
+}
+
+void paint_brot_pixel(struct pixel *pixel, double x, double y)
+{
+        brot_colour(pixel, brot_count(x, y));
+}
+
+/*
+ * Precision variants, all from brot_span.h: float for shallow views, where
+ * twice the lanes fit in a vector, int32_t fixed point for a little
+ * deeper, and double for the rest. Fixed point is Q7.24, which holds
+ * everything a view inside |c| <= 2 iterates to before escaping.
+ */
+
+#define SPAN_FRAC_BITS 24
+#define FIXED_EXTENT 4.0                /* Plane coordinates Q7.24 can iterate, |c| <= 2 */
+#define FLOAT_PIXEL 0x1p-12             /* Smallest pixel float renders exactly enough */
+
+enum {
+        FLOAT_MAX_ITER = 64,            /**< Most iterations float can take without drifting. */
+};
+
+#ifdef BROT_X86
+
+/* Q7.24 products of 8 or 16 lanes, from the even and odd lanes' 64 bit products. */
+__attribute__((target("avx2")))
+static inline __m256i mulq_avx2(__m256i a, __m256i b)
+{
+        __m256i even = _mm256_mul_epi32(a, b);
+        __m256i odd = _mm256_mul_epi32(_mm256_srli_epi64(a, 32), _mm256_srli_epi64(b, 32));
+
+        return _mm256_blend_epi32(_mm256_srli_epi64(even, SPAN_FRAC_BITS),
+                                  _mm256_slli_epi64(odd, 32 - SPAN_FRAC_BITS), 0xaa);
+}
+
+__attribute__((target("avx512f")))
+static inline __m512i mulq_avx512(__m512i a, __m512i b)
+{
+        __m512i even = _mm512_mul_epi32(a, b);
+        __m512i odd = _mm512_mul_epi32(_mm512_srli_epi64(a, 32), _mm512_srli_epi64(b, 32));
+
+        return _mm512_mask_blend_epi32(0xaaaa, _mm512_srli_epi64(even, SPAN_FRAC_BITS),
+                                       _mm512_slli_epi64(odd, 32 - SPAN_FRAC_BITS));
+}
+
+#define SPAN_ANY_SSE2(m) _mm_movemask_epi8((__m128i)(m))
+#define SPAN_ANY_AVX2(m) (!_mm256_testz_si256((__m256i)(m), (__m256i)(m)))
+#define SPAN_ANY_AVX512(m) _mm512_test_epi32_mask((__m512i)(m), (__m512i)(m))
+
+#define SPAN_NAME brot_span_float_avx512
+#define SPAN_ATTR __attribute__((target("avx512f")))
+#define SPAN_BYTES 64
+#define SPAN_REAL float
+#define SPAN_FIXED 0
+#define SPAN_ANY SPAN_ANY_AVX512
+#include "brot_span.h"
+
+#define SPAN_NAME brot_span_fixed_avx512
+#define SPAN_ATTR __attribute__((target("avx512f")))
+#define SPAN_BYTES 64
+#define SPAN_REAL int32_t
+#define SPAN_FIXED 1
+#define SPAN_ANY SPAN_ANY_AVX512
+#define SPAN_MULQ(a, b) ((__typeof__(a))mulq_avx512((__m512i)(a), (__m512i)(b)))
+#include "brot_span.h"
+
+#define SPAN_NAME brot_span_double_avx512
+#define SPAN_ATTR __attribute__((target("avx512f")))
+#define SPAN_BYTES 64
+#define SPAN_REAL double
+#define SPAN_FIXED 0
+#define SPAN_ANY SPAN_ANY_AVX512
+#include "brot_span.h"
+
+#define SPAN_NAME brot_span_float_avx2
+#define SPAN_ATTR __attribute__((target("avx2")))
+#define SPAN_BYTES 32
+#define SPAN_REAL float
+#define SPAN_FIXED 0
+#define SPAN_ANY SPAN_ANY_AVX2
+#include "brot_span.h"
+
+#define SPAN_NAME brot_span_fixed_avx2
+#define SPAN_ATTR __attribute__((target("avx2")))
+#define SPAN_BYTES 32
+#define SPAN_REAL int32_t
+#define SPAN_FIXED 1
+#define SPAN_ANY SPAN_ANY_AVX2
+#define SPAN_MULQ(a, b) ((__typeof__(a))mulq_avx2((__m256i)(a), (__m256i)(b)))
+#include "brot_span.h"
+
+#define SPAN_NAME brot_span_double_avx2
+#define SPAN_ATTR __attribute__((target("avx2")))
+#define SPAN_BYTES 32
+#define SPAN_REAL double
+#define SPAN_FIXED 0
+#define SPAN_ANY SPAN_ANY_AVX2
+#include "brot_span.h"
+
+#define SPAN_NAME brot_span_float_sse2
+#define SPAN_ATTR __attribute__((target("sse2")))
+#define SPAN_BYTES 16
+#define SPAN_REAL float
+#define SPAN_FIXED 0
+#define SPAN_ANY SPAN_ANY_SSE2
+#include "brot_span.h"
+
+#define SPAN_NAME brot_span_fixed_sse2
+#define SPAN_ATTR __attribute__((target("sse2")))
+#define SPAN_BYTES 16
+#define SPAN_REAL int32_t
+#define SPAN_FIXED 1
+#define SPAN_ANY SPAN_ANY_SSE2
+#include "brot_span.h"
+
+#define SPAN_NAME brot_span_double_sse2
+#define SPAN_ATTR __attribute__((target("sse2")))
+#define SPAN_BYTES 16
+#define SPAN_REAL double
+#define SPAN_FIXED 0
+#define SPAN_ANY SPAN_ANY_SSE2
+#include "brot_span.h"
+
+#endif /* BROT_X86 */
+
+/* Plain C for everything else, vectorised as far as the target allows. */
+#define SPAN_NAME brot_span_float_generic
+#define SPAN_ATTR
+#define SPAN_BYTES 16
+#define SPAN_REAL float
+#define SPAN_FIXED 0
+#include "brot_span.h"
+
+#define SPAN_NAME brot_span_fixed_generic
+#define SPAN_ATTR
+#define SPAN_BYTES 16
+#define SPAN_REAL int32_t
+#define SPAN_FIXED 1
+#include "brot_span.h"
+
+/*
+ * Deep zoom kernels: the same count, iterated as offsets from brot_orbit
+ * (see deep.c). xs and y are relative to the orbit's centre. A lane whose
+ * orbit comes closer to 0 than to the reference, or outlives it, is
+ * rebased onto the start of the reference. The vector kernels gather each
+ * lane's reference point and match the scalar one bit for bit.
+ */
+
+static inline int brot_deep_count(double dx, double dy)
+{
+        const double *rx = brot_orbit.x, *ry = brot_orbit.y;
+        double dcx = dx / 2;
+        double dcy = dy / 2;
+
+        double zx = 0;
+        double zy = 0;
+        int i = 0, m = 0;
+
+        while (i < brot_max_iter) {
+                double ax = (rx[m] + rx[m]) + zx;
+                double ay = (ry[m] + ry[m]) + zy;
+                double fx, fy, f2;
+
+                double xtemp = (ax*zx - ay*zy) + dcx;
+                zy = (ax*zy + ay*zx) + dcy;
+                zx = xtemp;
+                i++;
+                m++;
+
+                /* Where the pixel's orbit actually is. */
+                fx = rx[m] + zx;
+                fy = ry[m] + zy;
+                f2 = SQR(fx) + SQR(fy);
+                if (f2 >= 4.0)
+                        break;
+                if (f2 < SQR(zx) + SQR(zy) || m == brot_orbit.len) {
+                        zx = fx;
+                        zy = fy;
+                        m = 0;
+                }
+        }
+
+        return i;
+}
+
+static void brot_deep_span_scalar(uint16_t *counts, int32_t n,
+                                  const double *xs, double y)
+{
+        int32_t x;
+
+        for (x = 0; x < n; x++)
+                counts[x] = brot_deep_count(xs[x], y);
+}
+
+#ifdef BROT_X86
+
+__attribute__((target("avx2")))
+static void brot_deep_span_avx2(uint16_t *counts_out, int32_t n,
+                                const double *xs, double y)
+{
+        const __m256d four = _mm256_set1_pd(4.0);
+        const __m256d half = _mm256_set1_pd(0.5);
+        const __m256d dcy = _mm256_set1_pd(y / 2);
+        const __m256i len = _mm256_set1_epi64x(brot_orbit.len);
+        int64_t counts[4];
+        int32_t x;
+        int i, j;
+
+        for (x = 0; x + 4 <= n; x += 4) {
+                __m256d dcx = _mm256_mul_pd(_mm256_loadu_pd(xs + x), half);
+                __m256d zx = _mm256_setzero_pd();
+                __m256d zy = _mm256_setzero_pd();
+                __m256d active = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+                __m256i m = _mm256_setzero_si256();
+                __m256i count = _mm256_setzero_si256();
+
+                for (i = 0; i < brot_max_iter; i++) {
+                        __m256d rx = _mm256_i64gather_pd(brot_orbit.x, m, 8);
+                        __m256d ry = _mm256_i64gather_pd(brot_orbit.y, m, 8);
+                        __m256d ax = _mm256_add_pd(_mm256_add_pd(rx, rx), zx);
+                        __m256d ay = _mm256_add_pd(_mm256_add_pd(ry, ry), zy);
+                        __m256d xtemp, fx, fy, f2, rebase;
+
+                        xtemp = _mm256_add_pd(_mm256_sub_pd(_mm256_mul_pd(ax, zx),
+                                                            _mm256_mul_pd(ay, zy)), dcx);
+                        zy = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ax, zy),
+                                                         _mm256_mul_pd(ay, zx)), dcy);
+                        zx = xtemp;
+                        /* Active lanes are all ones, -1. */
+                        count = _mm256_sub_epi64(count, _mm256_castpd_si256(active));
+                        m = _mm256_sub_epi64(m, _mm256_castpd_si256(active));
+
+                        fx = _mm256_add_pd(_mm256_i64gather_pd(brot_orbit.x, m, 8), zx);
+                        fy = _mm256_add_pd(_mm256_i64gather_pd(brot_orbit.y, m, 8), zy);
+                        f2 = _mm256_add_pd(_mm256_mul_pd(fx, fx), _mm256_mul_pd(fy, fy));
+                        active = _mm256_andnot_pd(_mm256_cmp_pd(f2, four, _CMP_GE_OQ), active);
+                        if (!_mm256_movemask_pd(active))
+                                break;
+
+                        rebase = _mm256_or_pd(
+                                _mm256_cmp_pd(f2, _mm256_add_pd(_mm256_mul_pd(zx, zx),
+                                                                _mm256_mul_pd(zy, zy)),
+                                              _CMP_LT_OQ),
+                                _mm256_castsi256_pd(_mm256_cmpeq_epi64(m, len)));
+                        rebase = _mm256_and_pd(rebase, active);
+                        zx = _mm256_blendv_pd(zx, fx, rebase);
+                        zy = _mm256_blendv_pd(zy, fy, rebase);
+                        m = _mm256_andnot_si256(_mm256_castpd_si256(rebase), m);
+                }
+
+                _mm256_storeu_si256((__m256i *)counts, count);
+                for (j = 0; j < 4; j++)
+                        counts_out[x + j] = counts[j];
+        }
+
+        brot_deep_span_scalar(counts_out + x, n - x, xs + x, y);
+}
+
+__attribute__((target("avx512f")))
+static void brot_deep_span_avx512(uint16_t *counts_out, int32_t n,
+                                  const double *xs, double y)
+{
+        const __m512d four = _mm512_set1_pd(4.0);
+        const __m512d half = _mm512_set1_pd(0.5);
+        const __m512d dcy = _mm512_set1_pd(y / 2);
+        const __m512i len = _mm512_set1_epi64(brot_orbit.len);
+        const __m512i one = _mm512_set1_epi64(1);
+        int64_t counts[8];
+        int32_t x;
+        int i, j;
+
+        for (x = 0; x + 8 <= n; x += 8) {
+                __m512d dcx = _mm512_mul_pd(_mm512_loadu_pd(xs + x), half);
+                __m512d zx = _mm512_setzero_pd();
+                __m512d zy = _mm512_setzero_pd();
+                __m512i m = _mm512_setzero_si512();
+                __m512i count = _mm512_setzero_si512();
+                __mmask8 active = 0xff, rebase;
+
+                for (i = 0; i < brot_max_iter; i++) {
+                        __m512d rx = _mm512_i64gather_pd(m, brot_orbit.x, 8);
+                        __m512d ry = _mm512_i64gather_pd(m, brot_orbit.y, 8);
+                        __m512d ax = _mm512_add_pd(_mm512_add_pd(rx, rx), zx);
+                        __m512d ay = _mm512_add_pd(_mm512_add_pd(ry, ry), zy);
+                        __m512d xtemp, fx, fy, f2;
+
+                        xtemp = _mm512_add_pd(_mm512_sub_pd(_mm512_mul_pd(ax, zx),
+                                                            _mm512_mul_pd(ay, zy)), dcx);
+                        zy = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(ax, zy),
+                                                         _mm512_mul_pd(ay, zx)), dcy);
+                        zx = xtemp;
+                        count = _mm512_mask_add_epi64(count, active, count, one);
+                        m = _mm512_mask_add_epi64(m, active, m, one);
+
+                        fx = _mm512_add_pd(_mm512_i64gather_pd(m, brot_orbit.x, 8), zx);
+                        fy = _mm512_add_pd(_mm512_i64gather_pd(m, brot_orbit.y, 8), zy);
+                        f2 = _mm512_add_pd(_mm512_mul_pd(fx, fx), _mm512_mul_pd(fy, fy));
+                        active &= ~_mm512_cmp_pd_mask(f2, four, _CMP_GE_OQ);
+                        if (!active)
+                                break;
+
+                        rebase = active & (_mm512_cmp_pd_mask(f2, _mm512_add_pd(_mm512_mul_pd(zx, zx),
+                                                                                _mm512_mul_pd(zy, zy)),
+                                                              _CMP_LT_OQ)
+                                           | _mm512_cmpeq_epi64_mask(m, len));
+                        zx = _mm512_mask_mov_pd(zx, rebase, fx);
+                        zy = _mm512_mask_mov_pd(zy, rebase, fy);
+                        m = _mm512_mask_mov_epi64(m, rebase, _mm512_setzero_si512());
+                }
+
+                _mm512_storeu_si512(counts, count);
+                for (j = 0; j < 8; j++)
+                        counts_out[x + j] = counts[j];
+        }
+
+        brot_deep_span_avx2(counts_out + x, n - x, xs + x, y);
+}
+
+#endif /* BROT_X86 */
+
+/*
+ * Colouring: one palette lookup per pixel, with gathers where there are
+ * any.
+ */
+
+static void colour_span_scalar(struct pixel *row, const uint16_t *counts, int32_t n)
+{
+        const struct pixel *lut = palette_lut;
+        int32_t x;
+
+        for (x = 0; x < n; x++)
+                row[x] = lut[counts[x]];
+}
+
+#ifdef BROT_X86
+
+/*
+ * Nothing reads a coloured row back before the compositor does, so long
+ * spans are written with non-temporal stores: whole cache lines go
+ * straight to memory without being read in first or evicting the counts.
+ * Short spans (a few damaged pixels) would only get partial lines out of
+ * it, and are stored normally.
+ */
+enum {
+        COLOUR_STREAM_MIN = 256,        /**< Pixels in a span worth streaming. */
+};
+
+__attribute__((target("avx2")))
+static void colour_span_avx2(struct pixel *row, const uint16_t *counts, int32_t n)
+{
+        const int *lut = (const int *)palette_lut;
+        int stream = n >= COLOUR_STREAM_MIN;
+        int32_t x = 0;
+
+        /* Up to the first 32 byte boundary of row. */
+        if (stream) {
+                x = (-(uintptr_t)row / sizeof *row) & 7;
+                colour_span_scalar(row, counts, x);
+        }
+
+        for (; x + 8 <= n; x += 8) {
+                __m256i i = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(counts + x)));
+                __m256i c = _mm256_i32gather_epi32(lut, i, 4);
+
+                if (stream)
+                        _mm256_stream_si256((__m256i *)(row + x), c);
+                else
+                        _mm256_storeu_si256((__m256i *)(row + x), c);
+        }
+        if (stream)
+                _mm_sfence();
+
+        colour_span_scalar(row + x, counts + x, n - x);
+}
+
+__attribute__((target("avx512f")))
+static void colour_span_avx512(struct pixel *row, const uint16_t *counts, int32_t n)
+{
+        const int *lut = (const int *)palette_lut;
+        int stream = n >= COLOUR_STREAM_MIN;
+        int32_t x = 0;
+
+        /* Up to the first cache line boundary of row. */
+        if (stream) {
+                x = (-(uintptr_t)row / sizeof *row) & 15;
+                colour_span_scalar(row, counts, x);
+        }
+
+        for (; x + 16 <= n; x += 16) {
+                __m512i i = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i *)(counts + x)));
+                __m512i c = _mm512_i32gather_epi32(i, lut, 4);
+
+                if (stream)
+                        _mm512_stream_si512((__m512i *)(row + x), c);
+                else
+                        _mm512_storeu_si512(row + x, c);
+        }
+        if (stream)
+                _mm_sfence();
+
+        colour_span_avx2(row + x, counts + x, n - x);
+}
+
+#endif /* BROT_X86 */
+
+static const struct brot_kernel {
+        const char *name;
+        brot_span_fn spans[N_BROT_PRECISIONS];
+        brot_colour_fn colour;
+} brot_kernels[] = {
+#ifdef BROT_X86
+        { "avx512", { brot_span_float_avx512, brot_span_fixed_avx512,
+                      brot_span_double_avx512, brot_deep_span_avx512 }, colour_span_avx512 },
+        { "avx2",   { brot_span_float_avx2, brot_span_fixed_avx2,
+                      brot_span_double_avx2, brot_deep_span_avx2 }, colour_span_avx2 },
+        { "sse2",   { brot_span_float_sse2, brot_span_fixed_sse2,
+                      brot_span_double_sse2, brot_deep_span_scalar }, colour_span_scalar },
+#endif
+        { "scalar", { brot_span_float_generic, brot_span_fixed_generic,
+                      brot_span_scalar, brot_deep_span_scalar }, colour_span_scalar },
+};
+
+enum { N_BROT_KERNELS = sizeof brot_kernels / sizeof brot_kernels[0] };
+
+static const char *const precision_names[N_BROT_PRECISIONS] = {
+        [BROT_FLOAT]  = "float",
+        [BROT_FIXED]  = "fixed",
+        [BROT_DOUBLE] = "double",
+        [BROT_DEEP]   = "deep",
+};
+
+brot_span_fn brot_spans[N_BROT_PRECISIONS] = {
+        brot_span_float_generic, brot_span_fixed_generic,
+        brot_span_scalar, brot_deep_span_scalar,
+};
+brot_colour_fn brot_colour_span = colour_span_scalar;
+
+/* Precision $BROT_PRECISION asks for, -1 to choose by view. */
+static int forced_precision = -1;
+
+static int brot_kernel_supported(const struct brot_kernel *kernel)
+{
+#ifdef BROT_X86
+        __builtin_cpu_init();
+        if (kernel->colour == colour_span_avx512)
+                return __builtin_cpu_supports("avx512f");
+        if (kernel->colour == colour_span_avx2)
+                return __builtin_cpu_supports("avx2");
+        if (kernel->spans[BROT_DOUBLE] == brot_span_double_sse2)
+                return __builtin_cpu_supports("sse2");
+#endif
+        return 1;
+}
+
+/**
+ * Pick the widest kernel the CPU supports. Setting $BROT_KERNEL to one of
+ * avx512, avx2, sse2 or scalar forces that kernel instead (if supported),
+ * and $BROT_PRECISION to float, fixed or double forces that precision for
+ * every view that isn't deep.
+ */
+void brot_select_kernel(void)
+{
+        const char *want = getenv("BROT_KERNEL");
+        const char *precision = getenv("BROT_PRECISION");
+        int i;
+
+        for (i = 0; precision && i < BROT_DEEP; i++)
+                if (strcmp(precision, precision_names[i]) == 0)
+                        forced_precision = i;
+        if (precision && forced_precision < 0)
+                fprintf(stderr, "Mandelbrot precision '%s' not available\n", precision);
+
+        for (i = 0; i < N_BROT_KERNELS; i++) {
+                if (want && strcmp(want, brot_kernels[i].name) != 0)
+                        continue;
+                if (brot_kernel_supported(&brot_kernels[i]))
+                        break;
+        }
+        if (i == N_BROT_KERNELS) {
+                fprintf(stderr, "Mandelbrot kernel '%s' not available\n", want);
+                i = N_BROT_KERNELS - 1;
+        }
+
+        memcpy(brot_spans, brot_kernels[i].spans, sizeof brot_spans);
+        brot_colour_span = brot_kernels[i].colour;
+        fprintf(stderr, "Mandelbrot kernel: %s\n", brot_kernels[i].name);
+}
+
+/**
+ * The fastest precision that renders view at width x height closely
+ * enough. Float is good for a pixel down to about FLOAT_PIXEL, as long as
+ * brot_max_iter is too low for its rounding to add up, and even then
+ * counts near the boundary differ from double in up to 0.2% of the
+ * pixels (see precision_test.c). Double is good to DEEP_PIXEL, and deep
+ * views need perturbation. Fixed point is as close as float but measured
+ * slower than double on every kernel here, so it's only used when
+ * $BROT_PRECISION asks, and then only where it can't overflow.
+ */
+enum brot_precision brot_precision(const struct view *view,
+                                   int32_t width, int32_t height)
+{
+        double pixel, x0, y0, x1, y1, extent;
+
+        if (deep_view(view, width, height))
+                return BROT_DEEP;
+
+        view_map(view, width, height, &pixel, &x0, &y0);
+        x0 += view->pan_x * pixel;
+        y0 += view->pan_y * pixel;
+        x1 = x0 + width * pixel;
+        y1 = y0 + height * pixel;
+        extent = fmax(fmax(fabs(x0), fabs(x1)), fmax(fabs(y0), fabs(y1)));
+
+        if (forced_precision == BROT_FIXED)
+                return extent <= FIXED_EXTENT ? BROT_FIXED : BROT_DOUBLE;
+        if (forced_precision >= 0)
+                return forced_precision;
+
+        if (pixel >= FLOAT_PIXEL && brot_max_iter <= FLOAT_MAX_ITER)
+                return BROT_FLOAT;
+        return BROT_DOUBLE;
+}
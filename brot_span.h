@@ -0,0 +1,155 @@
+/*
+ * One mandelbrot span kernel, for brot.c to include once per precision
+ * and vector width. Before including, define:
+ *
+ *   SPAN_NAME         name of the brot_span_fn to define
+ *   SPAN_ATTR         attributes for it, e.g. __attribute__((target("avx2")))
+ *   SPAN_BYTES        vector width in bytes
+ *   SPAN_REAL         lane type: float, double, or int32_t for fixed point
+ *   SPAN_FIXED        1 if SPAN_REAL is fixed point with SPAN_FRAC_BITS
+ *                     fraction bits, 0 if it is floating point
+ *   SPAN_ANY(m)       optional, nonzero if any lane of mask vector m is set
+ *   SPAN_MULQ(a, b)   optional, for fixed point, the product of a and b
+ *                     rounded down (the low 32 bits of a * b >> SPAN_FRAC_BITS)
+ *
+ * The kernel is written with GCC vector extensions, so the compiler picks
+ * the instructions for the target of SPAN_ATTR. It is the same recurrence
+ * in the same order as brot_count(), with the same cardioid, bulb and
+ * periodicity checks, so the double variants match it bit for bit and
+ * the others differ only by their rounding.
+ *
+ * Everything defined here is undefined again at the end.
+ */
+
+#define SPAN_CAT_(a, b) a##b
+#define SPAN_CAT(a, b) SPAN_CAT_(a, b)
+#define SPAN_V SPAN_CAT(SPAN_NAME, _v)
+#define SPAN_LANES (SPAN_BYTES / (int)sizeof(SPAN_REAL))
+
+#define SPAN_M SPAN_CAT(SPAN_NAME, _m)
+
+typedef SPAN_REAL SPAN_V __attribute__((vector_size(SPAN_BYTES)));
+/* What comparing two SPAN_Vs gives, all ones in the lanes where true. */
+typedef __typeof__(__builtin_choose_expr(sizeof(SPAN_REAL) == 8, (int64_t)0, (int32_t)0))
+        SPAN_M __attribute__((vector_size(SPAN_BYTES)));
+
+#ifndef SPAN_ANY
+#define SPAN_ANY(m) ({                                          \
+        int any_ = 0, k_;                                       \
+        for (k_ = 0; k_ < SPAN_LANES; k_++)                     \
+                any_ |= (m)[k_] != 0;                           \
+        any_;                                                   \
+})
+#endif
+
+#if SPAN_FIXED
+typedef int64_t SPAN_CAT(SPAN_NAME, _w) __attribute__((vector_size(2 * SPAN_BYTES)));
+#ifndef SPAN_MULQ
+#define SPAN_MULQ(a, b) __builtin_convertvector(                             \
+        (__builtin_convertvector(a, SPAN_CAT(SPAN_NAME, _w))                   \
+         * __builtin_convertvector(b, SPAN_CAT(SPAN_NAME, _w))) >> SPAN_FRAC_BITS, \
+        SPAN_V)
+#endif
+#define SPAN_K(c) ((SPAN_REAL)((c) * (1 << SPAN_FRAC_BITS)))
+#define SPAN_MUL(a, b) SPAN_MULQ(a, b)
+#define SPAN_FROM(d) ((SPAN_REAL)lrint((d) * (1 << SPAN_FRAC_BITS)))
+#else
+#define SPAN_K(c) ((SPAN_REAL)(c))
+#define SPAN_MUL(a, b) ((a) * (b))
+#define SPAN_FROM(d) ((SPAN_REAL)(d))
+#endif
+
+SPAN_ATTR
+static void SPAN_NAME(uint16_t *counts_out, int32_t n, const double *xs, double y)
+{
+        const SPAN_V zero = { 0 };
+        const SPAN_V four = zero + SPAN_K(4.0);
+        const SPAN_V one = zero + SPAN_K(1.0);
+        const SPAN_V quarter = zero + SPAN_K(0.25);
+        const SPAN_V sixteenth = zero + SPAN_K(0.0625);
+        const SPAN_V y0 = zero + SPAN_FROM(y / 2);
+        const SPAN_V y02 = SPAN_MUL(y0, y0);
+        const SPAN_M none = { 0 };
+        const SPAN_M max_iter = none + brot_max_iter;
+        double pad[SPAN_LANES];
+        const double *in;
+        int32_t x;
+        int i, j, next;
+
+        for (x = 0; x < n; x += SPAN_LANES) {
+                SPAN_M active, interior, periodic, count;
+                SPAN_V x0, zx, zy, ox, oy, xq, q, xp;
+
+                /* Pad the last few pixels out to a whole vector. */
+                in = xs + x;
+                if (n - x < SPAN_LANES) {
+                        for (j = 0; j < SPAN_LANES; j++)
+                                pad[j] = xs[x + j < n ? x + j : n - 1];
+                        in = pad;
+                }
+                for (j = 0; j < SPAN_LANES; j++)
+                        x0[j] = SPAN_FROM(in[j] * 0.5);
+
+                zx = zy = ox = oy = zero;
+                xq = x0 - quarter;
+                q = SPAN_MUL(xq, xq) + y02;
+                xp = x0 + one;
+                interior = (SPAN_MUL(q, q + xq) <= SPAN_MUL(quarter, y02))
+                        | (SPAN_MUL(xp, xp) + y02 <= sixteenth);
+                count = interior & max_iter;
+                active = ~interior;
+
+                for (i = 0, next = 1; i < brot_max_iter; i++) {
+                        SPAN_V zx2 = SPAN_MUL(zx, zx);
+                        SPAN_V zy2 = SPAN_MUL(zy, zy);
+                        SPAN_V xtemp, ytemp;
+
+                        active &= zx2 + zy2 < four;
+                        if (!SPAN_ANY(active))
+                                break;
+                        /* Set lanes are -1. */
+                        count -= active;
+
+                        xtemp = (zx2 - zy2) + x0;
+                        ytemp = SPAN_MUL(zx + zx, zy) + y0;
+#if SPAN_FIXED
+                        /* Escaped lanes would overflow, keep them still. */
+                        zx = (xtemp & active) | (zx & ~active);
+                        zy = (ytemp & active) | (zy & ~active);
+#else
+                        zx = xtemp;
+                        zy = ytemp;
+#endif
+
+                        periodic = active & (zx == ox) & (zy == oy);
+                        if (SPAN_ANY(periodic)) {
+                                count = (count & ~periodic) | (max_iter & periodic);
+                                active &= ~periodic;
+                        }
+                        if (i + 1 == next) {
+                                ox = zx;
+                                oy = zy;
+                                next *= 2;
+                        }
+                }
+
+                for (j = 0; j < SPAN_LANES && x + j < n; j++)
+                        counts_out[x + j] = count[j];
+        }
+}
+
+#undef SPAN_CAT_
+#undef SPAN_CAT
+#undef SPAN_V
+#undef SPAN_M
+#undef SPAN_LANES
+#undef SPAN_K
+#undef SPAN_MUL
+#undef SPAN_FROM
+#undef SPAN_NAME
+#undef SPAN_ATTR
+#undef SPAN_BYTES
+#undef SPAN_REAL
+#undef SPAN_FIXED
+#undef SPAN_ANY
+#undef SPAN_MULQ
@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <wayland-client.h>
+#include "simple.h"
+
+/*
+ * The vector mandelbrot kernels must count exactly what the scalar ones
+ * do, in every precision, and colour the counts the same way. Each
+ * kernel set runs over a few views and is compared with the scalar set
+ * bit for bit. Kernels the CPU lacks are skipped.
+ */
+
+enum { WIDTH = 203, HEIGHT = 37, N_VIEWS = 3, MAX_ITER = 500 };
+
+static const struct view views[N_VIEWS] = {
+        { .radius = 1 },
+        { .cx = -1.5, .cy = 0.0, .radius = 0.1 },              /* Period-3 bulb */
+        { .cx = -1.4974, .cy = -0.0006, .radius = 0.002 },      /* Filaments */
+};
+
+static const char *const kernels[] = { "sse2", "avx2", "avx512" };
+
+static uint16_t want[N_VIEWS][N_BROT_PRECISIONS][HEIGHT][WIDTH];
+static struct pixel want_colour[N_VIEWS][HEIGHT][WIDTH];
+
+static void select_kernel(const char *name)
+{
+        setenv("BROT_KERNEL", name, 1);
+        brot_select_kernel();
+}
+
+/* Count and colour every view with the selected kernels. */
+static void render(uint16_t counts[N_VIEWS][N_BROT_PRECISIONS][HEIGHT][WIDTH],
+                   struct pixel colour[N_VIEWS][HEIGHT][WIDTH])
+{
+        double xs[WIDTH], pixel, x0, y0;
+        int v, p, x, y;
+
+        for (v = 0; v < N_VIEWS; v++) {
+                view_map(&views[v], WIDTH, HEIGHT, &pixel, &x0, &y0);
+                for (x = 0; x < WIDTH; x++)
+                        xs[x] = x * pixel + x0;
+                for (y = 0; y < HEIGHT; y++) {
+                        for (p = 0; p < BROT_DEEP; p++)
+                                brot_spans[p](counts[v][p][y], WIDTH, xs, y * pixel + y0);
+                        brot_colour_span(colour[v][y], counts[v][BROT_DOUBLE][y], WIDTH);
+                }
+        }
+}
+
+int main(void)
+{
+        static uint16_t got[N_VIEWS][N_BROT_PRECISIONS][HEIGHT][WIDTH];
+        static struct pixel got_colour[N_VIEWS][HEIGHT][WIDTH];
+        static const char *const precisions[] = { "float", "fixed", "double" };
+        brot_span_fn scalar;
+        int failed = 0, i, v, p;
+
+        brot_max_iter = MAX_ITER;
+        palette_update();
+
+        select_kernel("scalar");
+        scalar = brot_spans[BROT_DOUBLE];
+        render(want, want_colour);
+
+        for (i = 0; i < sizeof kernels / sizeof kernels[0]; i++) {
+                select_kernel(kernels[i]);
+                if (brot_spans[BROT_DOUBLE] == scalar) {
+                        printf("%s: not supported, skipped\n", kernels[i]);
+                        continue;
+                }
+                render(got, got_colour);
+
+                for (v = 0; v < N_VIEWS; v++) {
+                        for (p = 0; p < BROT_DEEP; p++) {
+                                if (memcmp(got[v][p], want[v][p], sizeof got[v][p]) == 0)
+                                        continue;
+                                printf("%s: %s counts differ from scalar in view %d\n",
+                                       kernels[i], precisions[p], v);
+                                failed = 1;
+                        }
+                        if (memcmp(got_colour[v], want_colour[v], sizeof got_colour[v]) != 0) {
+                                printf("%s: colours differ from scalar in view %d\n",
+                                       kernels[i], v);
+                                failed = 1;
+                        }
+                }
+        }
+
+        return failed;
+}
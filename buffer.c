@@ -7,23 +7,34 @@
 #include <time.h>
 
 #include <unistd.h>
+#include <sys/eventfd.h>
 #include <sys/mman.h>
 
 #include <wayland-client.h>
 #include "simple.h"
 
-#define BROT
-
-
-/* RGBA32 pixel */
-struct pixel {
-        uint8_t b, g, r, a;
-};
 
 /* Unlock buffer when wayland is done with it. */
 static void buffer_release(void *data, struct wl_buffer *buffer) {
+        static unsigned releases;
         struct my_buffer *my_buffer = data;
+        struct my_window *window;
+
+        /* Retired, its slot may hold another buffer now. */
+        if (!my_buffer)
+                return;
+        window = my_buffer->window;
         my_buffer->busy = 0;
+        my_buffer->released = ++releases;
+        if (trace_enabled)
+                trace_interval(TRACE_HELD, my_buffer->commit_ns, trace_now());
+
+        /* draw() gave up on a frame for want of this, try again. */
+        if (window->stalled) {
+                window->stalled = 0;
+                redraw(window);
+                render_ahead(window);
+        }
 };
 
 static const struct wl_buffer_listener buffer_listener = {
@@ -34,112 +45,169 @@ static const struct wl_callback_listener frame_listener = {
         draw,
 };
 
-enum { N_BALLS = 30 };
-
-struct metaball {
-        double x, y;
-        double dx, dy;
-} global_balls[N_BALLS];
+/*
+ * Destroy buffer's wl_buffer. The front buffer's is still what the
+ * surface shows, unless it has been retired already, so that one is kept
+ * until the next commit replaces it. Its memory stays with the
+ * compositor's mapping of the pool.
+ */
+static void retire_buffer(struct my_window *window, struct my_buffer *buffer)
+{
+        if (!buffer->buffer)
+                return;
+        if (buffer == window->front && !window->retired) {
+                wl_buffer_set_user_data(buffer->buffer, NULL);
+                window->retired = buffer->buffer;
+        } else {
+                wl_buffer_destroy(buffer->buffer);
+        }
+        buffer->buffer = NULL;
+}
 
-/**
- * Create a shared memory object and return the fd.
+/*
+ * Destroy every wl_buffer and the pool itself, so the next select_buffer()
+ * starts a fresh pool sized for the current window.
  */
-static int create_shm(size_t size,
-                      char **fname)
+static void release_pool(struct my_window *window)
 {
-        const char template[] = "/tmp/hello-wayland-XXXXXX";
-        char *tmpname;
-        int fd;
+        int i;
 
-        tmpname = malloc(sizeof template);
-        assert(tmpname != NULL);
-        memcpy(tmpname, template, sizeof template);
+        printf("Shrinking wl_shm_pool { size: %zu }\n", window->shm.size);
 
-        fd = mkstemp(tmpname);
-        if (fd < 0) {
-                perror("Failed making shm");
-                exit(1);
-        }
+        for (i = 0; i < window->n_buffers; i++) {
+                struct my_buffer *buffer = &window->buffers[i];
 
-        if (ftruncate(fd, size) < 0) {
-                close(fd);
-                perror("Failed to resize shm");
-                exit(1);
+                retire_buffer(window, buffer);
+                buffer->data = NULL;
+                buffer->offset = buffer->capacity = 0;
+                buffer->key.width = 0;
         }
 
-        if (fname != NULL) {
-                //*fname = tmpname;
+        wl_shm_pool_destroy(window->shm_pool);
+        window->shm_pool = NULL;
+        shm_destroy(&window->shm);
+        window->shm_used = 0;
+}
+
+/*
+ * Hand out a slot of size bytes from the end of the pool, growing it
+ * (by half again at least, so dragging a window edge doesn't resize on
+ * every frame) if it's full.
+ */
+static size_t alloc_slot(struct my_window *window, size_t size)
+{
+        size_t offset;
+        int i;
+
+        if (window->shm_used + size > window->shm.size) {
+                size_t want = window->shm.size + window->shm.size / 2;
+
+                if (want < window->shm_used + size)
+                        want = window->shm_used + size;
+                shm_grow(&window->shm, want);
+                wl_shm_pool_resize(window->shm_pool, window->shm.size);
+
+                /* The mapping may have moved. */
+                for (i = 0; i < window->n_buffers; i++) {
+                        struct my_buffer *buffer = &window->buffers[i];
+                        if (buffer->capacity)
+                                buffer->data = (char*)window->shm.data + buffer->offset;
+                }
         }
-        remove(tmpname);
 
-        return fd;
+        offset = window->shm_used;
+        window->shm_used += size;
+        return offset;
 }
 
+/*
+ * Whether a is a better buffer to draw into than b. Prefer the freshest
+ * contents, so the least has to be repainted, then the buffer the
+ * compositor gave back longest ago.
+ */
+static int buffer_better(const struct my_buffer *a, const struct my_buffer *b)
+{
+        if (!b)
+                return 1;
+        if (a->age != b->age)
+                return a->age && (!b->age || a->age < b->age);
+        return (int)(a->released - b->released) < 0;
+}
 
-struct my_buffer *select_buffer(struct my_window *window)
+/*
+ * Pick a free buffer for the next frame, of width x height. If the
+ * compositor is holding on to all of them, add another up to
+ * window->max_buffers. Returns NULL if there is none to be had.
+ */
+struct my_buffer *select_buffer(struct my_window *window,
+                                int32_t width, int32_t height)
 {
         struct my_display *display;
         struct my_buffer *buffer;
-        int fd;
-        void *data;
-        int buf_num;
+        int i, busy, n;
 
         int32_t stride;
-        int32_t max_buffer_size;
-        int32_t shm_pool_size;
+        size_t buffer_size;
         
         display = window->display;
 
-        stride = display->width * 4;
+        /* Round rows up to whole cache lines so render bands never share one. */
+        stride = (width * 4 + CACHE_LINE - 1) & ~(CACHE_LINE - 1);
         assert(stride > 0);
-        max_buffer_size = stride * display->height;
-        assert(max_buffer_size > 0);
-        shm_pool_size = max_buffer_size * BUFFERS;
-        assert(shm_pool_size > 0);
+        buffer_size = (size_t)stride * height;
+        assert(buffer_size > 0);
         
-        for (buf_num = 0; buf_num < BUFFERS; buf_num++) {
-                if (!window->buffers[buf_num].busy) {
-                        buffer = &window->buffers[buf_num];
-                        break;
-                }
+        buffer = NULL;
+        for (i = 0; i < window->n_buffers; i++) {
+                if (!window->buffers[i].busy
+                    && buffer_better(&window->buffers[i], buffer))
+                        buffer = &window->buffers[i];
         }
-        if (buf_num >= BUFFERS) {
-                return NULL;
+        if (!buffer) {
+                if (window->n_buffers >= window->max_buffers)
+                        return NULL;
+                buffer = &window->buffers[window->n_buffers++];
+                buffer->window = window;
+        }
+
+        /* Shrink lazily: once the window needs well under half the pool and
+         * the compositor has given every buffer back, start over. */
+        n = window->n_buffers > MIN_BUFFERS ? window->n_buffers : MIN_BUFFERS;
+        if (window->shm_pool && window->shm.size > 2 * n * buffer_size) {
+                for (i = 0, busy = 0; i < window->n_buffers; i++)
+                        busy |= window->buffers[i].busy;
+                if (!busy)
+                        release_pool(window);
         }
 
         if (!window->shm_pool) {
-                printf("Makeing new wl_shm_pool { size: %"PRId32" }\n", shm_pool_size);
-                fd = create_shm(shm_pool_size, &window->shm_fname);
-                data = mmap(NULL, shm_pool_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-                
-                if (data == MAP_FAILED) {
-                        close(fd);
-                        perror("Mmap failed");
-                        exit(1);
-                }
-                
-                window->shm_data = data;
-                window->shm_pool = wl_shm_create_pool(display->shm, fd, max_buffer_size * BUFFERS);
-                close(fd);
+                printf("Makeing new wl_shm_pool { size: %zu }\n", n * buffer_size);
+                shm_create(&window->shm, n * buffer_size);
+                window->shm_pool = wl_shm_create_pool(display->shm, window->shm.fd,
+                                                      window->shm.size);
+                window->shm_used = 0;
         }
 
         /* Destroy wl_buffer object if window was resized.  */
         if (buffer->buffer
-            && (buffer->width != window->width
-                || buffer->height != window->height))
-        {
-                printf("Window resized, destroying buffer %d\n", buf_num);
-                wl_buffer_destroy(buffer->buffer);
-                buffer->buffer = NULL;
-        } 
+            && (buffer->width != width
+                || buffer->height != height))
+                retire_buffer(window, buffer);
                 
         if (!buffer->buffer) {
-                int32_t mem_offset = max_buffer_size * buf_num;
+                /* Keep the old slot if the new size fits, otherwise take a
+                 * new one. The old slot is wasted until the pool shrinks,
+                 * the compositor may still be reading it. */
+                if (buffer->capacity < buffer_size) {
+                        buffer->offset = alloc_slot(window, buffer_size);
+                        buffer->capacity = buffer_size;
+                }
+
                 buffer->stride = stride;
-                buffer->width = window->width;
-                buffer->height = window->height;
+                buffer->width = width;
+                buffer->height = height;
                 buffer->buffer = wl_shm_pool_create_buffer(window->shm_pool,
-                                                           mem_offset,
+                                                           buffer->offset,
                                                            buffer->width,
                                                            buffer->height,
                                                            buffer->stride,
@@ -151,197 +219,411 @@ struct my_buffer *select_buffer(struct my_window *window)
 
                 wl_buffer_add_listener(buffer->buffer, &buffer_listener, buffer);
 
-                buffer->data = (char*)window->shm_data + mem_offset;
-        } else {
-                // return NULL;
+                buffer->age = 0;
         }
+        buffer->data = (char*)window->shm.data + buffer->offset;
 
         return buffer;
 }
 
-#define SQR(_X) ((_X)*(_X))
-
-void paint_meta_pixel(struct pixel *pixel, double x, double y)
+/*
+ * Draw now, unless a frame callback is already pending and will do it.
+ * Used to wake up an idle window when something changed.
+ */
+void redraw(struct my_window *window)
 {
-        const double RADIUS = 0.001;
-        
-        int i;
-        struct metaball *ball;
-        double sum = 0.0;
-
-        for (i = 0; i < N_BALLS; i++) {
-                ball = &global_balls[i];
-                sum += 1.0 / (SQR(x - ball->x) + SQR(y - ball->y));
-
-                if (SQR(x - ball->x) + SQR(y - ball->y) < RADIUS){
-                        // red = 255;
-                }                
-        }
-                
-        pixel->b = 0;
-        pixel->a = (sum > 255) ? 255 : 0;
-        pixel->r = 0;
-        pixel->g = (sum > 255) ? 255 : 0;
+        if (!window->callback)
+                draw(window, NULL, 0);
 }
 
-void paint_brot_pixel(struct pixel *pixel, double x, double y)
+/*
+ * Track the compositor's refresh interval from frame callback times.
+ * Shorter intervals are taken at once, longer ones only slowly, so frames
+ * we were late for don't stretch the estimate (and with it the render
+ * budget). Gaps from going idle are ignored.
+ */
+static void frame_cadence(struct my_window *window, uint32_t time)
 {
-        const int MAX = 50;
-        
-        double x0 = x / 2;
-        double y0 = y / 2;
-        
-        double zx = 0;
-        double zy = 0;
-        int i = 0;
-
-        while ( SQR(zx) + SQR(zy) < 4.0
-                && i < MAX) {
-                
-                double xtemp = SQR(zx) - SQR(zy)  + x0;
-                zy = 2*zx*zy + y0;
-                zx = xtemp;
-                i++;
-        }
-
-        if (i < MAX) {
-                pixel->a = ((double)i/(double)MAX) * 255;
-                pixel->r = 0;
-                pixel->g = 0;
-                pixel->b = 0;
-        } else {
-                pixel->a = 255;
-                pixel->r = 255;
-                pixel->g = 255;
-                pixel->b = 255;
+        uint64_t interval;
+
+        /* Presentation feedback tells the real thing. */
+        if (window->callback_ms && !window->present_refresh_ns) {
+                interval = (uint64_t)(uint32_t)(time - window->callback_ms) * 1000000;
+                if (interval > 0 && interval < 4 * REFRESH_NS) {
+                        if (interval < window->refresh_ns)
+                                window->refresh_ns = interval;
+                        else
+                                window->refresh_ns += (interval - window->refresh_ns) / 16;
+                }
         }
+        window->callback_ms = time;
 }
 
 /*
- * Draw the screen.
+ * Start rendering frame number window->frame into a free buffer on the
+ * render thread, to be committed as soon as it's done if commit is set.
+ * Does nothing if there's nothing new to show, or no buffer to show it in
+ * (a stall).
  */
-void draw(void *data_, struct wl_callback *callback, uint32_t serial)
+static void render_start(struct my_window *window, int commit)
 {
-        struct my_window *window = data_;
+        struct frame_job *job = &window->job;
         struct my_buffer *buffer;
-        int32_t i;
-        int32_t x, y;
         int32_t width, height;
-        time_t curr_time;
+        struct damage *frame_damage;
+        int k;
+        struct frame_key key;
 
-        /* Translated x,y pixel coords to cartesian cooridinates with 0,0 in middle */
-        double xx, yy;
-        double max_xx, max_yy;
-        
-        struct pixel *buffer_data;
+        assert(!window->rendering);
 
-        /* Fps counter */
-        static struct fps_counter {
-                time_t last_start;
-                int frames;
-        } fps_counter = { 0, 0 };
-        
-        buffer = select_buffer(window);
+        /* Smaller than the window if it's too slow to render at full size. */
+        scale_size(window, &width, &height);
+
+        /* The render thread is idle, so the scene can be read unlocked. */
+        scene_key(width, height, &key);
+
+        /* A scene that has stopped changing, like the mandelbrot set once
+         * refined, doesn't move. If the frame on screen is finished and
+         * still current there is nothing to do, so go idle until redraw()
+         * is called instead of asking for another frame callback. */
+        if (window->front && window->front->complete
+            && frame_key_equal(&window->front->key, &key))
+                return;
+
+        buffer = select_buffer(window, width, height);
         if (!buffer) {
-                //goto done;
+                /* The compositor holds every buffer we may have. Skip the
+                 * frame, buffer_release() will draw it when one comes back. */
+                window->stalls++;
+                window->stalled = 1;
+                return;
         }
 
-        width = window->width;
-        height = window->height;
-        
-        buffer_data = buffer->data;
-        assert(buffer_data != NULL);
+        *job = (struct frame_job){ 0 };
+        job->trace.acquire = TRACE_NOW();
+        job->buffer = buffer;
+        job->first = window->frame == 0;
+        job->budget_ns = present_budget(window, !commit);
+
+        /* Damage of this frame relative to the last one committed. A
+         * frame rendered ahead for this number and dropped has moved the
+         * scene on already, and what it moved is still to be repainted. */
+        frame_damage = &window->damage[window->frame % DAMAGE_HISTORY];
+        if (!window->ready_dropped)
+                damage_reset(frame_damage);
+        window->ready_dropped = 0;
+
+        /* Older damage is in the wrong coordinates after a resize. */
+        if (!window->front
+            || window->front->width != width
+            || window->front->height != height) {
+                damage_all(frame_damage);
+                for (k = 0; k < window->n_buffers; k++)
+                        window->buffers[k].age = 0;
+        }
+
+        /* Not free until the compositor is done with it. */
+        buffer->busy = 1;
+        window->rendering = 1;
+        window->commit_wanted = commit;
 
-        // printf("Drawing greyness\n");
-        // printf("Buffer offset = %zd\n",  (char*)buffer_data - (char*)window->shm_data);
+        pthread_mutex_lock(&window->render_lock);
+        window->job_posted = 1;
+        pthread_cond_signal(&window->render_cond);
+        pthread_mutex_unlock(&window->render_lock);
+}
 
-        if (width > height) {
-                max_yy = 1.0;
-                max_xx = (double)width / (double)height;
+/*
+ * Render window->job, on the render thread. Everything it touches besides
+ * the scene is left alone by the main thread until render_finish().
+ */
+static void render_job(struct my_window *window)
+{
+        struct frame_job *job = &window->job;
+        struct my_buffer *buffer = job->buffer;
+        struct canvas canvas;
+        struct damage *frame_damage;
+        struct damage repaint;
+        uint64_t start;
+        int k;
+
+        frame_damage = &window->damage[window->frame % DAMAGE_HISTORY];
+
+        pthread_mutex_lock(&scene_lock);
+        start = trace_now();
+
+        /* Input may have moved the scene on since render_start(). */
+        scene_key(buffer->width, buffer->height, &job->key);
+
+        /* This buffer may still hold the frame we want from earlier. */
+        job->render = !buffer->complete || !frame_key_equal(&buffer->key, &job->key);
+
+        job->done = scene_update(window->workers, job->first, frame_damage,
+                                 buffer->width, buffer->height, job->budget_ns);
+        if (!job->render)
+                damage_all(frame_damage);
+
+        /* A buffer holding frame N - age needs the damage of the last
+         * age frames repainted to catch up. */
+        damage_reset(&repaint);
+        if (buffer->age == 0 || buffer->age > DAMAGE_HISTORY) {
+                damage_all(&repaint);
         } else {
-                max_xx = 1.0;
-                max_yy = (double)height / (double)width;
+                for (k = 0; k < buffer->age; k++)
+                        damage_merge(&repaint,
+                                     &window->damage[(window->frame - k) % DAMAGE_HISTORY]);
         }
 
-#ifndef BROT
-        for (i = 0; i < N_BALLS; i++) {
-                struct metaball *ball = &global_balls[i];
-                if (!callback) {
-                        const double MAX_SPEED = 0.005;
-                        
-                        /* First call, setup metaballs */
-                        ball->x  = 2.0 * (double)rand()/RAND_MAX - 1.0;
-                        ball->y  = 2.0 * (double)rand()/RAND_MAX - 1.0;
-                        ball->dx = 2 * MAX_SPEED * (double)rand()/RAND_MAX - MAX_SPEED;
-                        ball->dy = 2 * MAX_SPEED * (double)rand()/RAND_MAX - MAX_SPEED;
-                        printf("ball %d: (%lf, %lf) at (%lf, %lf)\n",
-                               i, ball->x, ball->y, ball->dx, ball->dy);
-
-                } else {
-                        /* Update balls */
-                        ball->x += ball->dx;
-                        ball->y += ball->dy;
-        
-                        if (ball->x > 1.0 || ball->x < -1.0)
-                                ball->dx *= -1;
-                        if (ball->y > 1.0 || ball->y < -1.0)
-                                ball->dy *= -1;
-                }
+        canvas.data = buffer->data;
+        canvas.width = buffer->width;
+        canvas.height = buffer->height;
+        canvas.stride = buffer->stride;
+        if (job->render) {
+                job->trace.render_start = TRACE_NOW();
+                render_frame(window->workers, &canvas, &repaint);
+                job->trace.render_end = TRACE_NOW();
         }
-#endif
-        
-        for (y = 0; y < buffer->height; y++) {
-                for (x = 0; x < buffer->width; x++) {
-                        i = x + (y * buffer->stride)/4;
-
-                        xx = 2.0 * (double)x / (double)width - 1.0;
-                        yy = 2.0 * (double)y / (double)height - 1.0;
-                        
-                        xx *= max_xx; yy *= max_yy;
-#ifdef BROT
-                        paint_brot_pixel(&buffer_data[i], xx, yy);
-#else
-                        paint_meta_pixel(&buffer_data[i], xx, yy);
-#endif
-                }
+
+        job->render_ns = trace_now() - start;
+        pthread_mutex_unlock(&scene_lock);
+}
+
+static void *render_thread_main(void *data)
+{
+        struct my_window *window = data;
+        uint64_t one = 1;
+
+        pthread_mutex_lock(&window->render_lock);
+        for (;;) {
+                while (!window->render_quit && !window->job_posted)
+                        pthread_cond_wait(&window->render_cond, &window->render_lock);
+                if (window->render_quit)
+                        break;
+                window->job_posted = 0;
+                pthread_mutex_unlock(&window->render_lock);
+
+                render_job(window);
+
+                /* The main loop picks it up in render_finish(). */
+                pthread_mutex_lock(&window->render_lock);
+                if (write(window->render_fd, &one, sizeof one) != sizeof one)
+                        perror("Failed to post a rendered frame");
         }
-        // printf("Done drawing\n");
-        
-        /* for (i = 0; i < n_pixels; i++) { */
-        /*         x = (double)(i % window->width) / (double)window->width; */
-        /*         y = (double)(i / window->width) / (double)window->height; */
+        pthread_mutex_unlock(&window->render_lock);
 
-        /*         buffer_data[i].a = 255; // blue */
-        /*         buffer_data[i].r = 255 * x;  // green */
-        /*         buffer_data[i].g = 255 * y; // red */
-        /*         buffer_data[i].b = 0; // alpha */
-        /* } */
+        return NULL;
+}
+
+/**
+ * Start the thread that renders window's frames, so the main thread
+ * never waits on one.
+ */
+void render_thread_start(struct my_window *window)
+{
+        window->render_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (window->render_fd < 0) {
+                perror("Failed to create render eventfd");
+                exit(1);
+        }
+        pthread_mutex_init(&window->render_lock, NULL);
+        pthread_cond_init(&window->render_cond, NULL);
+        if (pthread_create(&window->render_thread, NULL,
+                           render_thread_main, window) != 0) {
+                perror("Failed to start render thread");
+                exit(1);
+        }
+}
+
+/**
+ * Stop window's render thread, once it has finished any frame it has.
+ */
+void render_thread_stop(struct my_window *window)
+{
+        pthread_mutex_lock(&window->render_lock);
+        window->render_quit = 1;
+        pthread_cond_signal(&window->render_cond);
+        pthread_mutex_unlock(&window->render_lock);
+        pthread_join(window->render_thread, NULL);
+
+        pthread_cond_destroy(&window->render_cond);
+        pthread_mutex_destroy(&window->render_lock);
+        close(window->render_fd);
+        window->render_fd = -1;
+        window->rendering = 0;
+}
+
+/*
+ * Commit buffer, holding frame number window->frame, and ask to hear
+ * when it's time for the next one.
+ */
+static void submit(struct my_window *window, struct my_buffer *buffer,
+                   struct frame_trace *trace)
+{
+        struct damage *frame_damage;
+        int k;
+
+        frame_damage = &window->damage[window->frame % DAMAGE_HISTORY];
 
-        
         /* Update surface */
         
         /* Tell compositor what to draw. */
         wl_surface_attach(window->surface, buffer->buffer, 0, 0);
-        /* Tell compositor that it needs to draw */
-        wl_surface_damage(window->surface, 0, 0, window->width, window->height);
-
-// done:
-        /* End frame render */
-        if (callback)
-                wl_callback_destroy(callback);
+        /* Tell compositor what changed. Without damage_buffer, a scaled
+         * buffer's damage can't be given in surface coordinates exactly. */
+        scale_viewport(window, buffer);
+        if ((buffer->width != window->width || buffer->height != window->height)
+            && wl_surface_get_version(window->surface) < WL_SURFACE_DAMAGE_BUFFER_SINCE_VERSION)
+                wl_surface_damage(window->surface, 0, 0, window->width, window->height);
+        else
+                damage_surface(window->surface, frame_damage, buffer->width, buffer->height);
 
         window->callback = wl_surface_frame(window->surface);
         wl_callback_add_listener(window->callback, &frame_listener, window);
+        present_feedback(window);
         wl_surface_commit(window->surface);
-        if (buffer)
-                buffer->busy = 1;
-
-        /* fps counter */
-        fps_counter.frames++;
-        time(&curr_time);
-        if (curr_time != fps_counter.last_start) {
-                printf("fps = %d\n", fps_counter.frames);
-                fps_counter.frames = 0;
-                fps_counter.last_start = curr_time;
+        if (window->retired) {
+                wl_buffer_destroy(window->retired);
+                window->retired = NULL;
+        }
+        trace->commit = TRACE_NOW();
+        buffer->commit_ns = trace->commit;
+        if (trace_enabled)
+                trace_frame(trace);
+        window->front = buffer;
+
+        for (k = 0; k < window->n_buffers; k++) {
+                if (&window->buffers[k] == buffer)
+                        buffer->age = 1;
+                else if (window->buffers[k].age)
+                        window->buffers[k].age++;
+        }
+        window->frame++;
+        /* A cycling palette moves on once per frame shown, only the
+         * mandelbrot set is coloured by it. The render thread is idle,
+         * see present(). */
+        if (renderer == &brot_renderer)
+                palette_tick();
+}
+
+/*
+ * Whether a frame rendered ahead no longer matches the window, because
+ * it was resized or the view (or anything else in its key) changed.
+ */
+static int ready_stale(const struct my_window *window,
+                       const struct my_buffer *ready)
+{
+        struct frame_key key;
+        int32_t width, height;
+
+        scale_size(window, &width, &height);
+        scene_key(width, height, &key);
+        if (!frame_key_equal(&ready->key, &key))
+                return 1;
+        return ready->width != width || ready->height != height;
+}
+
+/*
+ * Commit buffer, rendered to trace, as the frame last asked for.
+ */
+static void present(struct my_window *window, struct my_buffer *buffer,
+                    struct frame_trace *trace)
+{
+        trace->callback = window->callback_ns;
+        submit(window, buffer, trace);
+        render_ahead(window);
+}
+
+/*
+ * Render the next frame now, so the next frame callback only has to
+ * commit it. At most one frame is rendered ahead: the one on screen has
+ * to be presented (its frame callback is how we hear about that) before
+ * another is started.
+ */
+void render_ahead(struct my_window *window)
+{
+        if (!window->render_ahead || window->ready || window->rendering
+            || !window->callback)
+                return;
+        render_start(window, 0);
+}
+
+/*
+ * Take the frame the render thread has finished, when the main loop sees
+ * render_fd go readable. It's committed at once if a frame callback (or
+ * redraw()) has asked for it meanwhile, otherwise it waits in
+ * window->ready for the next one.
+ */
+void render_finish(struct my_window *window)
+{
+        struct frame_job *job = &window->job;
+        struct my_buffer *buffer = job->buffer;
+        uint64_t posted;
+
+        if (read(window->render_fd, &posted, sizeof posted) != sizeof posted
+            || !window->rendering)
+                return;
+
+        /* See everything the render thread wrote before posting. */
+        pthread_mutex_lock(&window->render_lock);
+        pthread_mutex_unlock(&window->render_lock);
+        window->rendering = 0;
+
+        if (job->render) {
+                buffer->key = job->key;
+                buffer->complete = job->done;
+                scale_update(window, job->render_ns);
         }
+
+        /* Even if input has moved the view since, it's the freshest there
+         * is, and a new one would only be more late. */
+        if (window->commit_wanted) {
+                window->commit_wanted = 0;
+                present(window, buffer, &job->trace);
+                return;
+        }
+        window->ready = buffer;
+        window->ready_trace = job->trace;
+}
+
+/*
+ * Draw the screen: commit the frame rendered ahead, or start one to be
+ * committed as soon as it's done. Never waits for rendering.
+ */
+void draw(void *data_, struct wl_callback *callback, uint32_t serial)
+{
+        struct my_window *window = data_;
+        struct my_buffer *buffer;
+        struct frame_trace trace;
+
+        window->callback_ns = TRACE_NOW();
+        if (callback)
+                frame_cadence(window, serial);
+
+        if (callback)
+                wl_callback_destroy(callback);
+        window->callback = NULL;
+
+        /* Commit it as soon as render_finish() has it. */
+        if (window->rendering) {
+                window->commit_wanted = 1;
+                return;
+        }
+
+        buffer = window->ready;
+        window->ready = NULL;
+        if (buffer && ready_stale(window, buffer)) {
+                /* Its damage is in the wrong coordinates now. */
+                buffer->busy = 0;
+                buffer->age = 0;
+                buffer = NULL;
+                window->ready_dropped = 1;
+        }
+
+        if (!buffer) {
+                render_start(window, 1);
+                return;
+        }
+
+        trace = window->ready_trace;
+        present(window, buffer, &trace);
 }
@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/socket.h>
+#include <unistd.h>
+#include <wayland-client.h>
+#include "simple.h"
+
+/*
+ * select_buffer() prefers the free buffer whose contents are the fewest
+ * frames old, then the one released longest ago, and only adds a buffer
+ * when every one is busy, up to max_buffers. Growing the pool must keep
+ * every buffer's data on its own slot of the new mapping, and shrinking
+ * it must not destroy the wl_buffer the surface is still showing.
+ *
+ * Nothing is dispatched, so the other end of the socket needs no server.
+ */
+
+enum { WIDTH = 100, HEIGHT = 50, N_BUFFERS = 3 };
+
+static struct my_display display;
+static struct my_window window;
+
+/* Check that every buffer with a slot has its data there, on its own. */
+static int check_slots(const char *what)
+{
+        int i, j;
+
+        for (i = 0; i < window.n_buffers; i++) {
+                struct my_buffer *a = &window.buffers[i];
+
+                if (!a->capacity)
+                        continue;
+                if (a->data != (char*)window.shm.data + a->offset
+                    || a->offset + a->capacity > window.shm_used
+                    || window.shm_used > window.shm.size) {
+                        printf("%s: buffer %d is off its slot\n", what, i);
+                        return 0;
+                }
+                for (j = 0; j < i; j++) {
+                        struct my_buffer *b = &window.buffers[j];
+
+                        if (a->offset < b->offset + b->capacity
+                            && b->offset < a->offset + a->capacity) {
+                                printf("%s: buffers %d and %d overlap\n", what, j, i);
+                                return 0;
+                        }
+                }
+        }
+        return 1;
+}
+
+/* Select a buffer and check it's the one wanted. */
+static int expect(int32_t width, int32_t height, int want, const char *what)
+{
+        struct my_buffer *buffer = select_buffer(&window, width, height);
+        int got = buffer ? (int)(buffer - window.buffers) : -1;
+
+        if (got != want) {
+                printf("%s: got buffer %d, wanted %d\n", what, got, want);
+                return 0;
+        }
+        if (buffer)
+                buffer->busy = 1;
+        return 1;
+}
+
+static void release(int i, int age, unsigned released)
+{
+        window.buffers[i].busy = 0;
+        window.buffers[i].age = age;
+        window.buffers[i].released = released;
+}
+
+int main(void)
+{
+        struct wl_buffer *front;
+        size_t size;
+        int failed = 0, fds[2], i;
+
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0) {
+                perror("socketpair");
+                return 1;
+        }
+        display.display = wl_display_connect_to_fd(fds[0]);
+        display.registry = wl_display_get_registry(display.display);
+        display.shm = wl_registry_bind(display.registry, 1, &wl_shm_interface, 1);
+        window.display = &display;
+        window.max_buffers = N_BUFFERS;
+        window.shm.fd = -1;
+
+        /* A buffer is added only while every other one is busy. */
+        for (i = 0; i < N_BUFFERS; i++)
+                failed |= !expect(WIDTH, HEIGHT, i, "adding");
+        failed |= !expect(WIDTH, HEIGHT, -1, "all busy");
+        failed |= !check_slots("adding");
+
+        /* Fewest frames old wins, undefined contents (age 0) lose. */
+        release(0, 2, 1);
+        release(1, 0, 2);
+        release(2, 1, 3);
+        failed |= !expect(WIDTH, HEIGHT, 2, "youngest");
+        release(2, 3, 3);
+        failed |= !expect(WIDTH, HEIGHT, 0, "defined over undefined");
+
+        /* Ties go to the buffer released longest ago. */
+        release(0, 1, 5);
+        release(1, 1, 3);
+        release(2, 1, 4);
+        failed |= !expect(WIDTH, HEIGHT, 1, "oldest release");
+        release(1, 0, 6);
+        release(2, 0, 7);
+        failed |= !expect(WIDTH, HEIGHT, 0, "oldest release, undefined");
+
+        /* A bigger buffer grows the pool, moving every buffer with it. */
+        window.max_buffers = N_BUFFERS + 1;
+        for (i = 0; i < N_BUFFERS; i++)
+                window.buffers[i].busy = 1;
+        size = window.shm.size;
+        failed |= !expect(4 * WIDTH, 4 * HEIGHT, N_BUFFERS, "growing");
+        if (window.shm.size <= size) {
+                printf("growing: pool stayed %zu bytes\n", window.shm.size);
+                failed = 1;
+        }
+        failed |= !check_slots("growing");
+
+        /* Shrinking the pool keeps what the surface shows until a commit. */
+        for (i = 0; i < window.n_buffers; i++)
+                release(i, 1, i);
+        window.front = &window.buffers[N_BUFFERS];
+        front = window.front->buffer;
+        size = window.shm.size;
+        failed |= !expect(WIDTH / 4, HEIGHT / 4, 0, "shrinking");
+        if (window.shm.size >= size) {
+                printf("shrinking: pool stayed %zu bytes\n", window.shm.size);
+                failed = 1;
+        }
+        if (window.retired != front || window.front->buffer == front) {
+                printf("shrinking: front's wl_buffer wasn't kept\n");
+                failed = 1;
+        }
+        failed |= !check_slots("shrinking");
+
+        for (i = 0; i < window.n_buffers; i++)
+                if (window.buffers[i].buffer)
+                        wl_buffer_destroy(window.buffers[i].buffer);
+        if (window.retired)
+                wl_buffer_destroy(window.retired);
+        wl_shm_pool_destroy(window.shm_pool);
+        shm_destroy(&window.shm);
+        wl_shm_destroy(display.shm);
+        wl_registry_destroy(display.registry);
+        wl_display_disconnect(display.display);
+        close(fds[1]);
+        return failed;
+}
@@ -0,0 +1,1012 @@
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <wayland-server.h>
+#include "presentation-time-server-protocol.h"
+#include "viewporter-server-protocol.h"
+#include "xdg-shell-server-protocol.h"
+
+/*
+ * A stand-in compositor, for running simple end to end without a real one.
+ *
+ * It advertises wl_compositor, wl_shm (libwayland-server's own, with
+ * ARGB8888 and XRGB8888), xdg_shell, wp_viewporter, wp_presentation and
+ * one wl_output, shows nothing, and only keeps time:
+ *
+ * - Frame callbacks are fired by a synthetic vblank every 1/--refresh
+ *   seconds, for everything committed before it. Presentation feedback
+ *   reports the vblank as when a commit was shown, or that it was
+ *   discarded if another commit replaced it first.
+ * - A buffer is released --release-delay ms after a commit replaces it
+ *   (at once for 0), like a compositor slow to finish reading it.
+ * - Every commit is timestamped. At exit the frame rate, the intervals
+ *   between commits, the time from a frame callback to the commit that
+ *   answers it and from a commit to the vblank that shows it are printed,
+ *   and --log writes the commit timestamps out.
+ *
+ * Run as
+ *
+ *   compositor [options] -- ./simple [args]
+ *
+ * to start the client on a socket of its own. It runs until the client
+ * exits, or for --duration seconds and then sends the client SIGINT and
+ * disconnects it (an idle client would never wake up to notice).
+ */
+
+/* Growable list of nanosecond samples. */
+struct samples {
+        uint64_t *v;
+        size_t n, cap;
+};
+
+static struct {
+        struct wl_display *display;
+        struct wl_event_loop *loop;
+        struct wl_list surfaces;
+        pid_t child;
+        int refresh_mhz;
+        uint64_t period_ns;
+        int release_ms;
+        int read;                       /* Read every committed buffer */
+        int32_t width, height;          /* Configured window size */
+        int32_t output_width, output_height;
+        const char *log;
+
+        uint64_t start_ns;
+        unsigned vblanks, shown, held, max_held, releases;
+        struct samples commits;         /* When each commit came in */
+        struct samples intervals;       /* Between consecutive commits */
+        struct samples render;          /* Frame callback to the next commit */
+        struct samples present;         /* Commit to the vblank that shows it */
+        uint32_t checksum;              /* Of the pixels read, so they are */
+} comp = {
+        .refresh_mhz = 60000,
+        .width = 1280, .height = 720,
+        .output_width = 1920, .output_height = 1080,
+};
+
+/* A buffer a surface showed, held until it's released. */
+struct held_buffer {
+        struct wl_resource *resource;
+        struct wl_listener destroy;
+        struct wl_event_source *timer;  /* Pending release, or NULL */
+};
+
+struct surface {
+        struct wl_resource *resource;
+        struct wl_list link;            /* comp.surfaces */
+        struct wl_resource *pending_buffer;
+        struct wl_listener pending_destroy;
+        int attached;                   /* attach since the last commit */
+        struct wl_list pending_frames;  /* Callbacks of the next commit */
+        struct wl_list frames;          /* Callbacks for the next vblank */
+        struct wl_list pending_feedback; /* Presentation feedback of the next commit */
+        struct wl_list feedback;        /* Feedback for content not shown yet */
+        struct held_buffer *current;
+        uint64_t content_ns;            /* Commit not shown yet, 0 if none */
+        uint64_t callback_ns;           /* Callbacks fired, no commit since */
+};
+
+static uint64_t now_ns(void)
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void sample(struct samples *s, uint64_t v)
+{
+        if (s->n == s->cap) {
+                s->cap = s->cap ? 2 * s->cap : 1024;
+                s->v = realloc(s->v, s->cap * sizeof *s->v);
+                if (!s->v) {
+                        perror(""); exit(1);
+                }
+        }
+        s->v[s->n++] = v;
+}
+
+/* Buffers */
+
+static void held_free(struct held_buffer *held)
+{
+        if (held->timer)
+                wl_event_source_remove(held->timer);
+        wl_list_remove(&held->destroy.link);
+        comp.held--;
+        free(held);
+}
+
+static void held_release(struct held_buffer *held)
+{
+        wl_buffer_send_release(held->resource);
+        comp.releases++;
+        held_free(held);
+}
+
+static int held_timer(void *data)
+{
+        held_release(data);
+        return 0;
+}
+
+static void held_destroyed(struct wl_listener *listener, void *data)
+{
+        struct held_buffer *held = wl_container_of(listener, held, destroy);
+        struct surface *surface;
+
+        wl_list_for_each(surface, &comp.surfaces, link)
+                if (surface->current == held)
+                        surface->current = NULL;
+        held_free(held);
+}
+
+static struct held_buffer *held_create(struct wl_resource *resource)
+{
+        struct held_buffer *held = calloc(1, sizeof *held);
+
+        if (!held) {
+                perror(""); exit(1);
+        }
+        held->resource = resource;
+        held->destroy.notify = held_destroyed;
+        wl_resource_add_destroy_listener(resource, &held->destroy);
+        if (++comp.held > comp.max_held)
+                comp.max_held = comp.held;
+        return held;
+}
+
+/* Done with held, now or after --release-delay. */
+static void held_done(struct held_buffer *held)
+{
+        if (comp.release_ms <= 0) {
+                held_release(held);
+                return;
+        }
+        held->timer = wl_event_loop_add_timer(comp.loop, held_timer, held);
+        wl_event_source_timer_update(held->timer, comp.release_ms);
+}
+
+/* Touch every pixel of a shm buffer, as a compositor uploading it would. */
+static void read_buffer(struct wl_resource *resource)
+{
+        struct wl_shm_buffer *shm = wl_shm_buffer_get(resource);
+        const uint32_t *row;
+        int32_t x, y, width, height, stride;
+
+        if (!shm)
+                return;
+        width = wl_shm_buffer_get_width(shm);
+        height = wl_shm_buffer_get_height(shm);
+        stride = wl_shm_buffer_get_stride(shm);
+
+        wl_shm_buffer_begin_access(shm);
+        for (y = 0; y < height; y++) {
+                row = (const uint32_t *)((const char *)wl_shm_buffer_get_data(shm) + y * stride);
+                for (x = 0; x < width; x++)
+                        comp.checksum += row[x];
+        }
+        wl_shm_buffer_end_access(shm);
+}
+
+/* Surfaces */
+
+static void callback_destroy(struct wl_resource *resource)
+{
+        wl_list_remove(wl_resource_get_link(resource));
+}
+
+static void pending_destroyed(struct wl_listener *listener, void *data)
+{
+        struct surface *surface = wl_container_of(listener, surface, pending_destroy);
+
+        surface->pending_buffer = NULL;
+        wl_list_remove(&surface->pending_destroy.link);
+        wl_list_init(&surface->pending_destroy.link);
+}
+
+static void surface_destroy(struct wl_client *client, struct wl_resource *resource)
+{
+        wl_resource_destroy(resource);
+}
+
+static void surface_attach(struct wl_client *client, struct wl_resource *resource,
+                           struct wl_resource *buffer, int32_t x, int32_t y)
+{
+        struct surface *surface = wl_resource_get_user_data(resource);
+
+        wl_list_remove(&surface->pending_destroy.link);
+        wl_list_init(&surface->pending_destroy.link);
+        surface->pending_buffer = buffer;
+        surface->attached = 1;
+        if (buffer)
+                wl_resource_add_destroy_listener(buffer, &surface->pending_destroy);
+}
+
+static void surface_damage(struct wl_client *client, struct wl_resource *resource,
+                           int32_t x, int32_t y, int32_t width, int32_t height)
+{
+}
+
+static void surface_frame(struct wl_client *client, struct wl_resource *resource,
+                          uint32_t id)
+{
+        struct surface *surface = wl_resource_get_user_data(resource);
+        struct wl_resource *callback;
+
+        callback = wl_resource_create(client, &wl_callback_interface, 1, id);
+        if (!callback) {
+                wl_client_post_no_memory(client);
+                return;
+        }
+        wl_resource_set_implementation(callback, NULL, NULL, callback_destroy);
+        wl_list_insert(surface->pending_frames.prev, wl_resource_get_link(callback));
+}
+
+static void surface_set_region(struct wl_client *client, struct wl_resource *resource,
+                               struct wl_resource *region)
+{
+}
+
+static void discard_feedback(struct wl_list *list)
+{
+        struct wl_resource *feedback, *next;
+
+        wl_resource_for_each_safe(feedback, next, list) {
+                wp_presentation_feedback_send_discarded(feedback);
+                wl_resource_destroy(feedback);
+        }
+}
+
+static void surface_commit(struct wl_client *client, struct wl_resource *resource)
+{
+        struct surface *surface = wl_resource_get_user_data(resource);
+        uint64_t now = now_ns();
+
+        if (comp.commits.n)
+                sample(&comp.intervals, now - comp.commits.v[comp.commits.n - 1]);
+        sample(&comp.commits, now);
+        if (surface->callback_ns) {
+                sample(&comp.render, now - surface->callback_ns);
+                surface->callback_ns = 0;
+        }
+
+        if (surface->attached) {
+                /* Content the next vblank would have shown never will be. */
+                if (surface->content_ns)
+                        discard_feedback(&surface->feedback);
+                if (surface->current)
+                        held_done(surface->current);
+                surface->current = NULL;
+                if (surface->pending_buffer) {
+                        if (comp.read)
+                                read_buffer(surface->pending_buffer);
+                        surface->current = held_create(surface->pending_buffer);
+                }
+                wl_list_remove(&surface->pending_destroy.link);
+                wl_list_init(&surface->pending_destroy.link);
+                surface->pending_buffer = NULL;
+                surface->attached = 0;
+                surface->content_ns = now;
+        }
+
+        wl_list_insert_list(surface->frames.prev, &surface->pending_frames);
+        wl_list_init(&surface->pending_frames);
+
+        wl_list_insert_list(surface->feedback.prev, &surface->pending_feedback);
+        wl_list_init(&surface->pending_feedback);
+}
+
+static void surface_set_int(struct wl_client *client, struct wl_resource *resource,
+                            int32_t value)
+{
+}
+
+static const struct wl_surface_interface surface_implementation = {
+        .destroy              = surface_destroy,
+        .attach               = surface_attach,
+        .damage               = surface_damage,
+        .frame                = surface_frame,
+        .set_opaque_region    = surface_set_region,
+        .set_input_region     = surface_set_region,
+        .commit               = surface_commit,
+        .set_buffer_transform = surface_set_int,
+        .set_buffer_scale     = surface_set_int,
+        .damage_buffer        = surface_damage,
+};
+
+static void destroy_callbacks(struct wl_list *list)
+{
+        struct wl_resource *callback, *next;
+
+        wl_resource_for_each_safe(callback, next, list)
+                wl_resource_destroy(callback);
+}
+
+static void surface_free(struct wl_resource *resource)
+{
+        struct surface *surface = wl_resource_get_user_data(resource);
+
+        destroy_callbacks(&surface->pending_frames);
+        destroy_callbacks(&surface->frames);
+        discard_feedback(&surface->pending_feedback);
+        discard_feedback(&surface->feedback);
+        wl_list_remove(&surface->pending_destroy.link);
+        if (surface->current)
+                held_free(surface->current);
+        wl_list_remove(&surface->link);
+        free(surface);
+}
+
+/* Regions, which nothing here looks at. */
+
+static void region_destroy(struct wl_client *client, struct wl_resource *resource)
+{
+        wl_resource_destroy(resource);
+}
+
+static void region_rect(struct wl_client *client, struct wl_resource *resource,
+                        int32_t x, int32_t y, int32_t width, int32_t height)
+{
+}
+
+static const struct wl_region_interface region_implementation = {
+        .destroy  = region_destroy,
+        .add      = region_rect,
+        .subtract = region_rect,
+};
+
+/* wl_compositor */
+
+static void compositor_create_surface(struct wl_client *client,
+                                      struct wl_resource *resource, uint32_t id)
+{
+        struct surface *surface;
+
+        surface = calloc(1, sizeof *surface);
+        if (!surface) {
+                wl_client_post_no_memory(client);
+                return;
+        }
+        surface->resource = wl_resource_create(client, &wl_surface_interface,
+                                               wl_resource_get_version(resource), id);
+        if (!surface->resource) {
+                free(surface);
+                wl_client_post_no_memory(client);
+                return;
+        }
+        wl_list_init(&surface->pending_frames);
+        wl_list_init(&surface->frames);
+        wl_list_init(&surface->pending_feedback);
+        wl_list_init(&surface->feedback);
+        wl_list_init(&surface->pending_destroy.link);
+        surface->pending_destroy.notify = pending_destroyed;
+        wl_list_insert(&comp.surfaces, &surface->link);
+        wl_resource_set_implementation(surface->resource, &surface_implementation,
+                                       surface, surface_free);
+}
+
+static void compositor_create_region(struct wl_client *client,
+                                     struct wl_resource *resource, uint32_t id)
+{
+        struct wl_resource *region;
+
+        region = wl_resource_create(client, &wl_region_interface, 1, id);
+        if (!region) {
+                wl_client_post_no_memory(client);
+                return;
+        }
+        wl_resource_set_implementation(region, &region_implementation, NULL, NULL);
+}
+
+static const struct wl_compositor_interface compositor_implementation = {
+        .create_surface = compositor_create_surface,
+        .create_region  = compositor_create_region,
+};
+
+static void compositor_bind(struct wl_client *client, void *data,
+                            uint32_t version, uint32_t id)
+{
+        struct wl_resource *resource;
+
+        resource = wl_resource_create(client, &wl_compositor_interface, version, id);
+        if (!resource) {
+                wl_client_post_no_memory(client);
+                return;
+        }
+        wl_resource_set_implementation(resource, &compositor_implementation, NULL, NULL);
+}
+
+/* xdg_shell, a window that is always --size and never anything else. */
+
+static void xdg_surface_destroy(struct wl_client *client, struct wl_resource *resource)
+{
+        wl_resource_destroy(resource);
+}
+
+static void xdg_surface_set_parent(struct wl_client *client, struct wl_resource *resource,
+                                   struct wl_resource *parent)
+{
+}
+
+static void xdg_surface_set_string(struct wl_client *client, struct wl_resource *resource,
+                                   const char *s)
+{
+}
+
+static void xdg_surface_show_window_menu(struct wl_client *client,
+                                         struct wl_resource *resource,
+                                         struct wl_resource *seat, uint32_t serial,
+                                         int32_t x, int32_t y)
+{
+}
+
+static void xdg_surface_move(struct wl_client *client, struct wl_resource *resource,
+                             struct wl_resource *seat, uint32_t serial)
+{
+}
+
+static void xdg_surface_resize(struct wl_client *client, struct wl_resource *resource,
+                               struct wl_resource *seat, uint32_t serial, uint32_t edges)
+{
+}
+
+static void xdg_surface_ack_configure(struct wl_client *client,
+                                      struct wl_resource *resource, uint32_t serial)
+{
+}
+
+static void xdg_surface_set_window_geometry(struct wl_client *client,
+                                            struct wl_resource *resource,
+                                            int32_t x, int32_t y,
+                                            int32_t width, int32_t height)
+{
+}
+
+static void xdg_surface_set_state(struct wl_client *client, struct wl_resource *resource)
+{
+}
+
+static void xdg_surface_set_fullscreen(struct wl_client *client,
+                                       struct wl_resource *resource,
+                                       struct wl_resource *output)
+{
+}
+
+static const struct xdg_surface_interface xdg_surface_implementation = {
+        .destroy             = xdg_surface_destroy,
+        .set_parent          = xdg_surface_set_parent,
+        .set_title           = xdg_surface_set_string,
+        .set_app_id          = xdg_surface_set_string,
+        .show_window_menu    = xdg_surface_show_window_menu,
+        .move                = xdg_surface_move,
+        .resize              = xdg_surface_resize,
+        .ack_configure       = xdg_surface_ack_configure,
+        .set_window_geometry = xdg_surface_set_window_geometry,
+        .set_maximized       = xdg_surface_set_state,
+        .unset_maximized     = xdg_surface_set_state,
+        .set_fullscreen      = xdg_surface_set_fullscreen,
+        .unset_fullscreen    = xdg_surface_set_state,
+        .set_minimized       = xdg_surface_set_state,
+};
+
+static void xdg_shell_destroy(struct wl_client *client, struct wl_resource *resource)
+{
+        wl_resource_destroy(resource);
+}
+
+static void xdg_shell_use_unstable_version(struct wl_client *client,
+                                           struct wl_resource *resource,
+                                           int32_t version)
+{
+}
+
+static void xdg_shell_get_xdg_surface(struct wl_client *client,
+                                      struct wl_resource *resource,
+                                      uint32_t id, struct wl_resource *surface)
+{
+        struct wl_resource *xdg_surface;
+        struct wl_array states;
+
+        xdg_surface = wl_resource_create(client, &xdg_surface_interface, 1, id);
+        if (!xdg_surface) {
+                wl_client_post_no_memory(client);
+                return;
+        }
+        wl_resource_set_implementation(xdg_surface, &xdg_surface_implementation, NULL, NULL);
+
+        wl_array_init(&states);
+        xdg_surface_send_configure(xdg_surface, comp.width, comp.height, &states,
+                                   wl_display_next_serial(comp.display));
+        wl_array_release(&states);
+}
+
+static void xdg_shell_get_xdg_popup(struct wl_client *client,
+                                    struct wl_resource *resource, uint32_t id,
+                                    struct wl_resource *surface,
+                                    struct wl_resource *parent,
+                                    struct wl_resource *seat, uint32_t serial,
+                                    int32_t x, int32_t y)
+{
+        wl_resource_post_error(resource, 0, "popups are not supported");
+}
+
+static void xdg_shell_pong(struct wl_client *client, struct wl_resource *resource,
+                           uint32_t serial)
+{
+}
+
+static const struct xdg_shell_interface xdg_shell_implementation = {
+        .destroy              = xdg_shell_destroy,
+        .use_unstable_version = xdg_shell_use_unstable_version,
+        .get_xdg_surface      = xdg_shell_get_xdg_surface,
+        .get_xdg_popup        = xdg_shell_get_xdg_popup,
+        .pong                 = xdg_shell_pong,
+};
+
+static void xdg_shell_bind(struct wl_client *client, void *data,
+                           uint32_t version, uint32_t id)
+{
+        struct wl_resource *resource;
+
+        resource = wl_resource_create(client, &xdg_shell_interface, 1, id);
+        if (!resource) {
+                wl_client_post_no_memory(client);
+                return;
+        }
+        wl_resource_set_implementation(resource, &xdg_shell_implementation, NULL, NULL);
+}
+
+/* wp_viewporter, so clients scale their buffers. Nothing is shown, so
+ * nothing needs scaling. */
+
+static void viewport_destroy(struct wl_client *client, struct wl_resource *resource)
+{
+        wl_resource_destroy(resource);
+}
+
+static void viewport_set_source(struct wl_client *client, struct wl_resource *resource,
+                                wl_fixed_t x, wl_fixed_t y,
+                                wl_fixed_t width, wl_fixed_t height)
+{
+}
+
+static void viewport_set_destination(struct wl_client *client,
+                                     struct wl_resource *resource,
+                                     int32_t width, int32_t height)
+{
+}
+
+static const struct wp_viewport_interface viewport_implementation = {
+        .destroy         = viewport_destroy,
+        .set_source      = viewport_set_source,
+        .set_destination = viewport_set_destination,
+};
+
+static void viewporter_destroy(struct wl_client *client, struct wl_resource *resource)
+{
+        wl_resource_destroy(resource);
+}
+
+static void viewporter_get_viewport(struct wl_client *client,
+                                    struct wl_resource *resource,
+                                    uint32_t id, struct wl_resource *surface)
+{
+        struct wl_resource *viewport;
+
+        viewport = wl_resource_create(client, &wp_viewport_interface, 1, id);
+        if (!viewport) {
+                wl_client_post_no_memory(client);
+                return;
+        }
+        wl_resource_set_implementation(viewport, &viewport_implementation, NULL, NULL);
+}
+
+static const struct wp_viewporter_interface viewporter_implementation = {
+        .destroy      = viewporter_destroy,
+        .get_viewport = viewporter_get_viewport,
+};
+
+static void viewporter_bind(struct wl_client *client, void *data,
+                            uint32_t version, uint32_t id)
+{
+        struct wl_resource *resource;
+
+        resource = wl_resource_create(client, &wp_viewporter_interface, 1, id);
+        if (!resource) {
+                wl_client_post_no_memory(client);
+                return;
+        }
+        wl_resource_set_implementation(resource, &viewporter_implementation, NULL, NULL);
+}
+
+/* wp_presentation, on CLOCK_MONOTONIC like everything else here. */
+
+static void presentation_destroy(struct wl_client *client, struct wl_resource *resource)
+{
+        wl_resource_destroy(resource);
+}
+
+static void presentation_feedback(struct wl_client *client,
+                                  struct wl_resource *resource,
+                                  struct wl_resource *surface_resource,
+                                  uint32_t id)
+{
+        struct surface *surface = wl_resource_get_user_data(surface_resource);
+        struct wl_resource *feedback;
+
+        feedback = wl_resource_create(client, &wp_presentation_feedback_interface, 1, id);
+        if (!feedback) {
+                wl_client_post_no_memory(client);
+                return;
+        }
+        wl_resource_set_implementation(feedback, NULL, NULL, callback_destroy);
+        wl_list_insert(surface->pending_feedback.prev, wl_resource_get_link(feedback));
+}
+
+static const struct wp_presentation_interface presentation_implementation = {
+        .destroy  = presentation_destroy,
+        .feedback = presentation_feedback,
+};
+
+static void presentation_bind(struct wl_client *client, void *data,
+                              uint32_t version, uint32_t id)
+{
+        struct wl_resource *resource;
+
+        resource = wl_resource_create(client, &wp_presentation_interface, 1, id);
+        if (!resource) {
+                wl_client_post_no_memory(client);
+                return;
+        }
+        wl_resource_set_implementation(resource, &presentation_implementation, NULL, NULL);
+        wp_presentation_send_clock_id(resource, CLOCK_MONOTONIC);
+}
+
+/* wl_output, one --output sized screen refreshing at --refresh. */
+
+static void output_bind(struct wl_client *client, void *data,
+                        uint32_t version, uint32_t id)
+{
+        struct wl_resource *resource;
+
+        resource = wl_resource_create(client, &wl_output_interface, version, id);
+        if (!resource) {
+                wl_client_post_no_memory(client);
+                return;
+        }
+        wl_resource_set_implementation(resource, NULL, NULL, NULL);
+
+        wl_output_send_geometry(resource, 0, 0, 0, 0, WL_OUTPUT_SUBPIXEL_UNKNOWN,
+                                "simple", "stand-in", WL_OUTPUT_TRANSFORM_NORMAL);
+        wl_output_send_mode(resource, WL_OUTPUT_MODE_CURRENT | WL_OUTPUT_MODE_PREFERRED,
+                            comp.output_width, comp.output_height, comp.refresh_mhz);
+        if (version >= WL_OUTPUT_SCALE_SINCE_VERSION)
+                wl_output_send_scale(resource, 1);
+        if (version >= WL_OUTPUT_DONE_SINCE_VERSION)
+                wl_output_send_done(resource);
+}
+
+/* Tell everyone waiting on surface's content that it was shown at now. */
+static void send_presented(struct surface *surface, uint64_t now)
+{
+        struct wl_resource *feedback, *next;
+        uint64_t sec = now / 1000000000;
+
+        wl_resource_for_each_safe(feedback, next, &surface->feedback) {
+                wp_presentation_feedback_send_presented(feedback, sec >> 32, (uint32_t)sec,
+                                                        now % 1000000000, comp.period_ns,
+                                                        0, comp.vblanks,
+                                                        WP_PRESENTATION_FEEDBACK_KIND_VSYNC);
+                wl_resource_destroy(feedback);
+        }
+}
+
+/* The synthetic vblank: show what was committed, fire frame callbacks and
+ * send presentation feedback. */
+static int vblank(int fd, uint32_t mask, void *data)
+{
+        struct surface *surface;
+        struct wl_resource *callback, *next;
+        uint64_t expirations, now = now_ns();
+
+        if (read(fd, &expirations, sizeof expirations) != sizeof expirations)
+                return 0;
+        comp.vblanks += expirations;
+
+        wl_list_for_each(surface, &comp.surfaces, link) {
+                if (surface->content_ns) {
+                        sample(&comp.present, now - surface->content_ns);
+                        surface->content_ns = 0;
+                        comp.shown++;
+                }
+                send_presented(surface, now);
+                if (wl_list_empty(&surface->frames))
+                        continue;
+                wl_resource_for_each_safe(callback, next, &surface->frames) {
+                        wl_callback_send_done(callback, (uint32_t)(now / 1000000));
+                        wl_resource_destroy(callback);
+                }
+                surface->callback_ns = now;
+        }
+        return 0;
+}
+
+/* Run --duration out: tell the client to quit, main() disconnects it. */
+static int duration_over(int fd, uint32_t mask, void *data)
+{
+        uint64_t expirations;
+
+        if (read(fd, &expirations, sizeof expirations) < 0)
+                return 0;
+        if (comp.child > 0)
+                kill(comp.child, SIGINT);
+        wl_display_terminate(comp.display);
+        return 0;
+}
+
+static int child_exited(int signal_number, void *data)
+{
+        int status;
+
+        if (comp.child > 0 && waitpid(comp.child, &status, WNOHANG) == comp.child) {
+                comp.child = 0;
+                wl_display_terminate(comp.display);
+        }
+        return 0;
+}
+
+static int interrupted(int signal_number, void *data)
+{
+        if (comp.child > 0)
+                kill(comp.child, SIGINT);
+        wl_display_terminate(comp.display);
+        return 0;
+}
+
+static int timer_create_ns(uint64_t first_ns, uint64_t interval_ns)
+{
+        struct itimerspec spec = {
+                .it_interval = { interval_ns / 1000000000, interval_ns % 1000000000 },
+                .it_value = { first_ns / 1000000000, first_ns % 1000000000 },
+        };
+        int fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+
+        if (fd < 0 || timerfd_settime(fd, 0, &spec, NULL) < 0) {
+                perror("timerfd");
+                exit(1);
+        }
+        return fd;
+}
+
+/* Start argv on the compositor's socket. */
+static void spawn(char **argv, const char *socket)
+{
+        sigset_t none;
+
+        comp.child = fork();
+        if (comp.child < 0) {
+                perror("fork");
+                exit(1);
+        }
+        if (comp.child > 0)
+                return;
+
+        /* The event loop blocks the signals it handles, don't pass that on. */
+        sigemptyset(&none);
+        sigprocmask(SIG_SETMASK, &none, NULL);
+        setenv("WAYLAND_DISPLAY", socket, 1);
+        execvp(argv[0], argv);
+        perror(argv[0]);
+        _exit(127);
+}
+
+/* Reports */
+
+static int u64_compare(const void *a_, const void *b_)
+{
+        uint64_t a = *(const uint64_t *)a_, b = *(const uint64_t *)b_;
+
+        return (a > b) - (a < b);
+}
+
+static void print_percentiles(const char *name, struct samples *s)
+{
+        size_t p99;
+
+        if (!s->n) {
+                printf("%-20s -\n", name);
+                return;
+        }
+        qsort(s->v, s->n, sizeof *s->v, u64_compare);
+        p99 = (s->n * 99 + 99) / 100 - 1;
+        if (p99 >= s->n)
+                p99 = s->n - 1;
+        printf("%-20s p50 %8.3f ms  p99 %8.3f ms  max %8.3f ms\n", name,
+               s->v[s->n / 2] / 1e6, s->v[p99] / 1e6, s->v[s->n - 1] / 1e6);
+}
+
+static void report(void)
+{
+        double seconds = 0;
+        FILE *f;
+        size_t i;
+
+        if (comp.log) {
+                f = fopen(comp.log, "w");
+                if (!f) {
+                        perror(comp.log);
+                } else {
+                        for (i = 0; i < comp.commits.n; i++)
+                                fprintf(f, "%llu\n", (unsigned long long)
+                                        (comp.commits.v[i] - comp.start_ns));
+                        fclose(f);
+                }
+        }
+
+        /* From the first commit to the last, leaving out startup. */
+        if (comp.commits.n > 1)
+                seconds = (comp.commits.v[comp.commits.n - 1] - comp.commits.v[0]) / 1e9;
+        printf("commits: %zu in %.3f s, %.1f fps\n", comp.commits.n, seconds,
+               seconds > 0 ? (comp.commits.n - 1) / seconds : 0.0);
+        printf("vblanks: %u at %.3f Hz, %u showed a new frame\n", comp.vblanks,
+               comp.refresh_mhz / 1000.0, comp.shown);
+        printf("buffers: %u released, at most %u held at once\n",
+               comp.releases, comp.max_held);
+        print_percentiles("commit interval", &comp.intervals);
+        print_percentiles("callback to commit", &comp.render);
+        print_percentiles("commit to vblank", &comp.present);
+}
+
+static void usage(const char *name)
+{
+        fprintf(stderr,
+                "Usage: %s [options] [-- client [args]]\n"
+                "  --refresh HZ         Synthetic refresh rate (default 60)\n"
+                "  --release-delay MS   Hold replaced buffers this long (default 0)\n"
+                "  --size WxH           Window size to configure (default 1280x720)\n"
+                "  --output WxH         Size of the one output (default 1920x1080)\n"
+                "  --read               Read every committed buffer, like an upload\n"
+                "  --duration S         Stop the client after S seconds (default until\n"
+                "                       it exits)\n"
+                "  --log FILE           Write commit times in ns, one per line\n",
+                name);
+}
+
+int main(int argc, char **argv)
+{
+        static const struct option long_options[] = {
+                { "refresh",       required_argument, NULL, 'r' },
+                { "release-delay", required_argument, NULL, 'd' },
+                { "size",          required_argument, NULL, 's' },
+                { "output",        required_argument, NULL, 'o' },
+                { "read",          no_argument,       NULL, 'R' },
+                { "duration",      required_argument, NULL, 't' },
+                { "log",           required_argument, NULL, 'l' },
+                { "help",          no_argument,       NULL, 'h' },
+                { NULL, 0, NULL, 0 }
+        };
+        char runtime_dir[] = "/tmp/compositor-XXXXXX";
+        int made_runtime_dir = 0;
+        double refresh = 60, duration = 0;
+        const char *socket;
+        int opt, vblank_fd, duration_fd = -1;
+
+        while ((opt = getopt_long(argc, argv, "+r:d:s:o:Rt:l:h", long_options, NULL)) != -1) {
+                switch (opt) {
+                case 'r':
+                        refresh = atof(optarg);
+                        if (refresh <= 0) {
+                                fprintf(stderr, "Bad refresh rate '%s'\n", optarg);
+                                return 1;
+                        }
+                        break;
+                case 'd':
+                        comp.release_ms = atoi(optarg);
+                        break;
+                case 's':
+                        if (sscanf(optarg, "%dx%d", &comp.width, &comp.height) != 2) {
+                                fprintf(stderr, "Bad size '%s', expected WxH\n", optarg);
+                                return 1;
+                        }
+                        break;
+                case 'o':
+                        if (sscanf(optarg, "%dx%d", &comp.output_width, &comp.output_height) != 2) {
+                                fprintf(stderr, "Bad size '%s', expected WxH\n", optarg);
+                                return 1;
+                        }
+                        break;
+                case 'R':
+                        comp.read = 1;
+                        break;
+                case 't':
+                        duration = atof(optarg);
+                        break;
+                case 'l':
+                        comp.log = optarg;
+                        break;
+                default:
+                        usage(argv[0]);
+                        return opt == 'h' ? 0 : 1;
+                }
+        }
+        comp.refresh_mhz = refresh * 1000;
+        comp.period_ns = 1e9 / refresh;
+
+        /* Sockets go in $XDG_RUNTIME_DIR, make one up if there is none. */
+        if (!getenv("XDG_RUNTIME_DIR")) {
+                if (!mkdtemp(runtime_dir)) {
+                        perror(runtime_dir);
+                        return 1;
+                }
+                setenv("XDG_RUNTIME_DIR", runtime_dir, 1);
+                made_runtime_dir = 1;
+        }
+
+        wl_list_init(&comp.surfaces);
+        comp.display = wl_display_create();
+        if (!comp.display) {
+                fprintf(stderr, "Couldn't create display\n");
+                return 1;
+        }
+        comp.loop = wl_display_get_event_loop(comp.display);
+        socket = wl_display_add_socket_auto(comp.display);
+        if (!socket) {
+                perror("Couldn't add socket");
+                return 1;
+        }
+
+        if (wl_display_init_shm(comp.display) < 0
+            || !wl_global_create(comp.display, &wl_compositor_interface, 4, NULL, compositor_bind)
+            || !wl_global_create(comp.display, &xdg_shell_interface, 1, NULL, xdg_shell_bind)
+            || !wl_global_create(comp.display, &wp_viewporter_interface, 1, NULL, viewporter_bind)
+            || !wl_global_create(comp.display, &wp_presentation_interface, 1, NULL, presentation_bind)
+            || !wl_global_create(comp.display, &wl_output_interface, 2, NULL, output_bind)) {
+                fprintf(stderr, "Couldn't create globals\n");
+                return 1;
+        }
+
+        vblank_fd = timer_create_ns(comp.period_ns, comp.period_ns);
+        wl_event_loop_add_fd(comp.loop, vblank_fd, WL_EVENT_READABLE, vblank, NULL);
+        if (duration > 0) {
+                duration_fd = timer_create_ns(duration * 1e9, 0);
+                wl_event_loop_add_fd(comp.loop, duration_fd, WL_EVENT_READABLE,
+                                     duration_over, NULL);
+        }
+        /* Before spawning, so a client that dies at once isn't missed. */
+        wl_event_loop_add_signal(comp.loop, SIGCHLD, child_exited, NULL);
+        wl_event_loop_add_signal(comp.loop, SIGINT, interrupted, NULL);
+        wl_event_loop_add_signal(comp.loop, SIGTERM, interrupted, NULL);
+
+        printf("Compositor on %s, %.3f Hz\n", socket, refresh);
+        fflush(stdout);
+        comp.start_ns = now_ns();
+        if (optind < argc)
+                spawn(argv + optind, socket);
+
+        wl_display_run(comp.display);
+
+        report();
+
+        wl_display_destroy_clients(comp.display);
+        if (comp.child > 0)
+                waitpid(comp.child, NULL, 0);
+        wl_display_destroy(comp.display);
+        close(vblank_fd);
+        if (duration_fd >= 0)
+                close(duration_fd);
+        if (made_runtime_dir)
+                rmdir(runtime_dir);
+        return 0;
+}
@@ -0,0 +1,196 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <wayland-client.h>
+#include "simple.h"
+
+/*
+ * Damage tracking.
+ *
+ * A damage is a short list of rectangles in buffer coordinates, or the
+ * whole buffer. Rectangles may overlap, damage_row_spans() flattens them
+ * into disjoint spans for rendering.
+ *
+ * damage_add() merges a rectangle into another when their bounding box
+ * covers few pixels that neither does, at most 1/MERGE_WASTE of the new
+ * one. That folds a moving object's rects from consecutive frames
+ * together when buffer ages stack them up. Once the list is full the new
+ * rectangle joins whichever one wastes least, so the damage stays close
+ * instead of turning into a full repaint.
+ */
+
+enum {
+        MERGE_WASTE = 16,               /**< Merge when waste * MERGE_WASTE <= area. */
+};
+
+void damage_reset(struct damage *damage)
+{
+        damage->n_rects = 0;
+        damage->full = 0;
+}
+
+void damage_all(struct damage *damage)
+{
+        damage->n_rects = 0;
+        damage->full = 1;
+}
+
+static int64_t rect_area(struct rect r)
+{
+        return (int64_t)r.width * r.height;
+}
+
+static struct rect rect_bounds(struct rect a, struct rect b)
+{
+        int32_t x1 = a.x + a.width > b.x + b.width ? a.x + a.width : b.x + b.width;
+        int32_t y1 = a.y + a.height > b.y + b.height ? a.y + a.height : b.y + b.height;
+        struct rect r;
+
+        r.x = a.x < b.x ? a.x : b.x;
+        r.y = a.y < b.y ? a.y : b.y;
+        r.width = x1 - r.x;
+        r.height = y1 - r.y;
+        return r;
+}
+
+/* Pixels the bounding box of a and b covers that neither of them does. */
+static int64_t merge_waste(struct rect a, struct rect b)
+{
+        int32_t x0 = a.x > b.x ? a.x : b.x;
+        int32_t y0 = a.y > b.y ? a.y : b.y;
+        int32_t x1 = a.x + a.width < b.x + b.width ? a.x + a.width : b.x + b.width;
+        int32_t y1 = a.y + a.height < b.y + b.height ? a.y + a.height : b.y + b.height;
+        int64_t overlap = x1 > x0 && y1 > y0 ? (int64_t)(x1 - x0) * (y1 - y0) : 0;
+
+        return rect_area(rect_bounds(a, b)) - rect_area(a) - rect_area(b) + overlap;
+}
+
+void damage_add(struct damage *damage, struct rect rect)
+{
+        int64_t waste, best_waste;
+        int i, best;
+
+        if (damage->full || rect.width <= 0 || rect.height <= 0)
+                return;
+
+        for (;;) {
+                best = -1;
+                best_waste = INT64_MAX;
+                for (i = 0; i < damage->n_rects; i++) {
+                        waste = merge_waste(damage->rects[i], rect);
+                        if (waste < best_waste) {
+                                best_waste = waste;
+                                best = i;
+                        }
+                }
+
+                if ((best < 0 || best_waste * MERGE_WASTE > rect_area(rect))
+                    && damage->n_rects < MAX_DAMAGE_RECTS) {
+                        damage->rects[damage->n_rects++] = rect;
+                        return;
+                }
+
+                /* Merge, then see whether the bigger rect takes in others */
+                rect = rect_bounds(damage->rects[best], rect);
+                damage->rects[best] = damage->rects[--damage->n_rects];
+        }
+}
+
+void damage_merge(struct damage *dst, const struct damage *src)
+{
+        int i;
+
+        if (src->full) {
+                damage_all(dst);
+                return;
+        }
+
+        for (i = 0; i < src->n_rects; i++)
+                damage_add(dst, src->rects[i]);
+}
+
+static int span_compare(const void *a_, const void *b_)
+{
+        const struct span *a = a_, *b = b_;
+
+        return (a->x0 > b->x0) - (a->x0 < b->x0);
+}
+
+/**
+ * Fill spans with the sorted, disjoint parts of row y that are damaged.
+ * spans must have room for MAX_DAMAGE_RECTS entries. Returns the count.
+ */
+int damage_row_spans(const struct damage *damage,
+                     int32_t y, int32_t width,
+                     struct span *spans)
+{
+        int i, n = 0, merged;
+
+        if (damage->full) {
+                spans[0].x0 = 0;
+                spans[0].x1 = width;
+                return 1;
+        }
+
+        for (i = 0; i < damage->n_rects; i++) {
+                const struct rect *r = &damage->rects[i];
+
+                if (y < r->y || y >= r->y + r->height)
+                        continue;
+                spans[n].x0 = r->x;
+                spans[n].x1 = r->x + r->width;
+                n++;
+        }
+
+        if (n <= 1)
+                return n;
+
+        qsort(spans, n, sizeof *spans, span_compare);
+
+        merged = 0;
+        for (i = 1; i < n; i++) {
+                if (spans[i].x0 <= spans[merged].x1) {
+                        if (spans[i].x1 > spans[merged].x1)
+                                spans[merged].x1 = spans[i].x1;
+                } else {
+                        spans[++merged] = spans[i];
+                }
+        }
+
+        return merged + 1;
+}
+
+/**
+ * Report damage to the compositor. Uses buffer coordinates when the
+ * surface is new enough, otherwise surface coordinates, which are the
+ * same only while the buffer is shown at its own size. Once
+ * scale_viewport() stretches it, a rect's surface coordinates are
+ * fractional, so callers must damage the whole surface instead.
+ */
+void damage_surface(struct wl_surface *surface,
+                    const struct damage *damage,
+                    int32_t width, int32_t height)
+{
+        int use_buffer = wl_surface_get_version(surface)
+                >= WL_SURFACE_DAMAGE_BUFFER_SINCE_VERSION;
+        int i;
+
+        if (damage->full) {
+                if (use_buffer)
+                        wl_surface_damage_buffer(surface, 0, 0, width, height);
+                else
+                        wl_surface_damage(surface, 0, 0, width, height);
+                return;
+        }
+
+        for (i = 0; i < damage->n_rects; i++) {
+                const struct rect *r = &damage->rects[i];
+
+                if (use_buffer)
+                        wl_surface_damage_buffer(surface, r->x, r->y,
+                                                 r->width, r->height);
+                else
+                        wl_surface_damage(surface, r->x, r->y,
+                                          r->width, r->height);
+        }
+}
@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <wayland-client.h>
+#include "simple.h"
+
+/*
+ * damage_add() merges rects that waste at most 1/16 of the new one's
+ * area, keeps the others apart, and once the list is full folds a rect
+ * into the one it wastes least on rather than giving up on the list. Any
+ * way it goes the damage must cover every rect added, without turning
+ * into a full repaint, and damage_row_spans() must give every row's
+ * spans sorted and disjoint.
+ */
+
+enum { WIDTH = 640, HEIGHT = 480, ROUNDS = 50 };
+
+static unsigned char added[HEIGHT][WIDTH];
+
+static void add(struct damage *damage, struct rect r)
+{
+        int32_t x, y;
+
+        for (y = r.y; y < r.y + r.height; y++)
+                for (x = r.x; x < r.x + r.width; x++)
+                        added[y][x] = 1;
+        damage_add(damage, r);
+}
+
+/* A random rect of up to max x max pixels inside the buffer. */
+static struct rect random_rect(int32_t max)
+{
+        struct rect r;
+
+        r.width = 1 + rand() % max;
+        r.height = 1 + rand() % max;
+        r.x = rand() % (WIDTH - r.width + 1);
+        r.y = rand() % (HEIGHT - r.height + 1);
+        return r;
+}
+
+/* Check damage's spans against every rect added. Returns pixels covered. */
+static long check(const struct damage *damage, const char *what)
+{
+        struct span spans[MAX_DAMAGE_RECTS];
+        int32_t x, y;
+        int n, s, failed = 0;
+        long covered = 0;
+
+        if (damage->full) {
+                printf("%s: full repaint\n", what);
+                return -1;
+        }
+        if (damage->n_rects > MAX_DAMAGE_RECTS) {
+                printf("%s: %d rects\n", what, damage->n_rects);
+                return -1;
+        }
+
+        for (y = 0; y < HEIGHT; y++) {
+                n = damage_row_spans(damage, y, WIDTH, spans);
+                for (s = 0; s < n; s++) {
+                        if (spans[s].x0 >= spans[s].x1
+                            || (s > 0 && spans[s].x0 <= spans[s - 1].x1)) {
+                                printf("%s: row %d spans empty, unsorted or touching\n",
+                                       what, y);
+                                return -1;
+                        }
+                        covered += spans[s].x1 - spans[s].x0;
+                }
+                for (x = 0, s = 0; x < WIDTH && !failed; x++) {
+                        while (s < n && spans[s].x1 <= x)
+                                s++;
+                        if (added[y][x] && (s == n || spans[s].x0 > x)) {
+                                printf("%s: pixel %d,%d not damaged\n", what, x, y);
+                                failed = 1;
+                        }
+                }
+                if (failed)
+                        return -1;
+        }
+        return covered;
+}
+
+static void reset(struct damage *damage)
+{
+        damage_reset(damage);
+        memset(added, 0, sizeof added);
+}
+
+int main(void)
+{
+        static struct damage damage, other;
+        int failed = 0, round, i;
+        long covered;
+
+        /* Side by side halves merge, far apart rects don't. */
+        reset(&damage);
+        add(&damage, (struct rect){ 10, 10, 50, 20 });
+        add(&damage, (struct rect){ 60, 10, 50, 20 });
+        if (damage.n_rects != 1 || check(&damage, "halves") != 100 * 20) {
+                printf("halves: %d rects\n", damage.n_rects);
+                failed = 1;
+        }
+        add(&damage, (struct rect){ 400, 300, 20, 20 });
+        if (damage.n_rects != 2 || check(&damage, "apart") != 100 * 20 + 20 * 20) {
+                printf("apart: %d rects\n", damage.n_rects);
+                failed = 1;
+        }
+
+        /* Waste of 1/16 of the new rect merges, a pixel more doesn't. */
+        reset(&damage);
+        add(&damage, (struct rect){ 0, 0, 16, 16 });
+        add(&damage, (struct rect){ 0, 17, 16, 16 });    /* Wastes 16 of 256 */
+        if (damage.n_rects != 1) {
+                printf("1/16 waste: %d rects\n", damage.n_rects);
+                failed = 1;
+        }
+        reset(&damage);
+        add(&damage, (struct rect){ 0, 0, 16, 16 });
+        add(&damage, (struct rect){ 0, 17, 15, 16 });    /* Wastes 32 of 240 */
+        if (damage.n_rects != 2) {
+                printf("over 1/16 waste: %d rects\n", damage.n_rects);
+                failed = 1;
+        }
+
+        /* A full list folds new rects in, and stays well short of full. */
+        reset(&damage);
+        for (i = 0; i < 4 * MAX_DAMAGE_RECTS; i++)
+                add(&damage, (struct rect){ (i % 32) * 20, (i / 32) * 30, 4, 4 });
+        covered = check(&damage, "full list");
+        if (covered < 0 || covered > WIDTH * HEIGHT / 2) {
+                printf("full list: %ld pixels covered\n", covered);
+                failed = 1;
+        }
+
+        /* Random rects, added straight or merged from another damage. */
+        srand(1);
+        for (round = 0; round < ROUNDS; round++) {
+                reset(&damage);
+                damage_reset(&other);
+                for (i = rand() % (2 * MAX_DAMAGE_RECTS); i > 0; i--) {
+                        if (rand() & 1)
+                                add(&damage, random_rect(round % 2 ? 8 : 100));
+                        else
+                                add(&other, random_rect(40));
+                }
+                damage_merge(&damage, &other);
+                if (check(&damage, "random") < 0) {
+                        printf("random round %d failed\n", round);
+                        failed = 1;
+                }
+        }
+
+        return failed;
+}
@@ -0,0 +1,292 @@
+#include <assert.h>
+#include <ctype.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include <wayland-client.h>
+#include "simple.h"
+
+/*
+ * Deep zooms.
+ *
+ * Past a pixel size of about DEEP_PIXEL, doubles can no longer tell
+ * neighbouring pixels' coordinates apart well enough to iterate them. So
+ * the view's centre is kept as a double-double (cx + cx_lo, about 106 bits),
+ * one reference orbit is iterated at the centre in double-double, and
+ * every pixel is iterated as a small difference from it in plain doubles:
+ *
+ *   z[n+1] = (2 Z[n] + z[n]) z[n] + dc
+ *
+ * where Z is the reference orbit and z, dc are the pixel's offsets from
+ * Z and the centre. The per pixel work is the same size as before and
+ * runs through the same span kernels and render threads (see the
+ * BROT_DEEP kernels in brot.c).
+ *
+ * A pixel whose orbit comes closer to 0 than to the reference has lost
+ * the precision of its offset (a "glitch"), and one that outlives the
+ * reference has nothing to be an offset from. Both are rebased onto the
+ * start of the reference orbit, z = Z[n] + z[n], Z = Z[0] = 0, so any
+ * reference will do and no pixel needs a second one.
+ *
+ * Double-double centres run out at a radius of about DEEP_MIN_RADIUS, which
+ * view_zoom() won't go past.
+ */
+
+/* An unevaluated sum hi + lo with |lo| <= ulp(hi) / 2. */
+struct dd {
+        double hi, lo;
+};
+
+/* Exact a + b, for any a and b. */
+static struct dd two_sum(double a, double b)
+{
+        double s = a + b;
+        double bb = s - a;
+
+        return (struct dd){ s, (a - (s - bb)) + (b - bb) };
+}
+
+/* Exact a + b, for |a| >= |b|. */
+static struct dd quick_two_sum(double a, double b)
+{
+        double s = a + b;
+
+        return (struct dd){ s, b - (s - a) };
+}
+
+/* Exact a * b, by Dekker's splitting (FMAs are off, see the Makefile). */
+static struct dd two_prod(double a, double b)
+{
+        double p = a * b;
+        double t, ah, al, bh, bl;
+
+        t = 134217729.0 * a;            /* 2^27 + 1 */
+        ah = t - (t - a);
+        al = a - ah;
+        t = 134217729.0 * b;
+        bh = t - (t - b);
+        bl = b - bh;
+
+        return (struct dd){ p, ((ah * bh - p) + ah * bl + al * bh) + al * bl };
+}
+
+static struct dd dd_add(struct dd a, struct dd b)
+{
+        struct dd s = two_sum(a.hi, b.hi);
+        struct dd t = two_sum(a.lo, b.lo);
+
+        s.lo += t.hi;
+        s = quick_two_sum(s.hi, s.lo);
+        s.lo += t.lo;
+        return quick_two_sum(s.hi, s.lo);
+}
+
+static struct dd dd_neg(struct dd a)
+{
+        return (struct dd){ -a.hi, -a.lo };
+}
+
+static struct dd dd_mul(struct dd a, struct dd b)
+{
+        struct dd p = two_prod(a.hi, b.hi);
+
+        p.lo += a.hi * b.lo + a.lo * b.hi;
+        return quick_two_sum(p.hi, p.lo);
+}
+
+static struct dd dd_div(struct dd a, struct dd b)
+{
+        double q1, q2, q3;
+        struct dd r;
+
+        q1 = a.hi / b.hi;
+        r = dd_add(a, dd_neg(dd_mul((struct dd){ q1, 0 }, b)));
+        q2 = r.hi / b.hi;
+        r = dd_add(r, dd_neg(dd_mul((struct dd){ q2, 0 }, b)));
+        q3 = r.hi / b.hi;
+
+        r = quick_two_sum(q1, q2);
+        return dd_add(r, (struct dd){ q3, 0 });
+}
+
+/* 10^e, e >= 0. */
+static struct dd dd_pow10(int e)
+{
+        struct dd p = { 1, 0 }, x = { 10, 0 };
+
+        for (; e; e >>= 1) {
+                if (e & 1)
+                        p = dd_mul(p, x);
+                x = dd_mul(x, x);
+        }
+        return p;
+}
+
+struct brot_orbit brot_orbit;
+
+/* What brot_orbit was last iterated for. */
+static struct {
+        double cx, cx_lo, cy, cy_lo;
+        int max_iter;
+} orbit_key = { .max_iter = -1 };
+
+/**
+ * 1 if view shown at width x height has pixels too small for doubles, and
+ * must be rendered with the BROT_DEEP kernels relative to its centre.
+ */
+int deep_view(const struct view *view, int32_t width, int32_t height)
+{
+        double pixel, x0, y0;
+
+        view_map(view, width, height, &pixel, &x0, &y0);
+        return pixel < DEEP_PIXEL;
+}
+
+/**
+ * Iterate the reference orbit at the centre of view into brot_orbit, if it
+ * isn't there already.
+ */
+void deep_reference(const struct view *view)
+{
+        struct dd cx, cy, zx, zy, zx2, zy2;
+        int n;
+
+        if (orbit_key.cx == view->cx && orbit_key.cx_lo == view->cx_lo
+            && orbit_key.cy == view->cy && orbit_key.cy_lo == view->cy_lo
+            && orbit_key.max_iter == brot_max_iter)
+                return;
+
+        if (orbit_key.max_iter < brot_max_iter) {
+                brot_orbit.x = realloc(brot_orbit.x, (brot_max_iter + 1) * sizeof *brot_orbit.x);
+                brot_orbit.y = realloc(brot_orbit.y, (brot_max_iter + 1) * sizeof *brot_orbit.y);
+                assert(brot_orbit.x && brot_orbit.y);
+        }
+
+        /* Plane coordinates are twice c, as in brot_count(). */
+        cx = (struct dd){ view->cx / 2, view->cx_lo / 2 };
+        cy = (struct dd){ view->cy / 2, view->cy_lo / 2 };
+        zx = zy = (struct dd){ 0, 0 };
+
+        for (n = 0; ; n++) {
+                brot_orbit.x[n] = zx.hi;
+                brot_orbit.y[n] = zy.hi;
+                zx2 = dd_mul(zx, zx);
+                zy2 = dd_mul(zy, zy);
+                if (n == brot_max_iter || zx2.hi + zy2.hi >= 4.0)
+                        break;
+
+                zy = dd_add(dd_mul((struct dd){ 2 * zx.hi, 2 * zx.lo }, zy), cy);
+                zx = dd_add(dd_add(zx2, dd_neg(zy2)), cx);
+        }
+        brot_orbit.len = n;
+
+        orbit_key.cx = view->cx;
+        orbit_key.cx_lo = view->cx_lo;
+        orbit_key.cy = view->cy;
+        orbit_key.cy_lo = view->cy_lo;
+        orbit_key.max_iter = brot_max_iter;
+}
+
+void deep_destroy(void)
+{
+        free(brot_orbit.x);
+        free(brot_orbit.y);
+        brot_orbit = (struct brot_orbit){ NULL, NULL, 0 };
+        orbit_key.max_iter = -1;
+}
+
+/**
+ * Move the centre of view by dx, dy, keeping every bit of it.
+ */
+void deep_move(struct view *view, double dx, double dy)
+{
+        struct dd x = dd_add((struct dd){ view->cx, view->cx_lo }, (struct dd){ dx, 0 });
+        struct dd y = dd_add((struct dd){ view->cy, view->cy_lo }, (struct dd){ dy, 0 });
+
+        view->cx = x.hi;
+        view->cx_lo = x.lo;
+        view->cy = y.hi;
+        view->cy_lo = y.lo;
+}
+
+/**
+ * Where coordinates in view a are measured from, less where they are in
+ * view b: the centre of a deep view, 0 for any other.
+ */
+void deep_origin_shift(const struct view *a, int a_deep,
+                       const struct view *b, int b_deep,
+                       double *dx, double *dy)
+{
+        struct dd x = { 0, 0 }, y = { 0, 0 };
+
+        if (a_deep) {
+                x = (struct dd){ a->cx, a->cx_lo };
+                y = (struct dd){ a->cy, a->cy_lo };
+        }
+        if (b_deep) {
+                x = dd_add(x, (struct dd){ -b->cx, -b->cx_lo });
+                y = dd_add(y, (struct dd){ -b->cy, -b->cy_lo });
+        }
+        *dx = x.hi + x.lo;
+        *dy = y.hi + y.lo;
+}
+
+/* Parse a decimal number into a double-double, returning the end or NULL. */
+static const char *parse_dd(const char *s, struct dd *out)
+{
+        struct dd v = { 0, 0 };
+        int neg = 0, digits = 0, scale = 0, e = 0;
+        char *end;
+
+        if (*s == '-' || *s == '+')
+                neg = *s++ == '-';
+        for (; isdigit((unsigned char)*s) || (*s == '.' && scale == 0); s++) {
+                if (*s == '.') {
+                        scale = -1;
+                        continue;
+                }
+                v = dd_add(dd_mul(v, (struct dd){ 10, 0 }), (struct dd){ *s - '0', 0 });
+                digits++;
+                if (scale < 0)
+                        scale--;
+        }
+        if (!digits)
+                return NULL;
+        if (scale < 0)
+                e = scale + 1;
+        if (*s == 'e' || *s == 'E') {
+                e += strtol(s + 1, &end, 10);
+                s = end;
+        }
+
+        v = e < 0 ? dd_div(v, dd_pow10(-e)) : dd_mul(v, dd_pow10(e));
+        *out = neg ? dd_neg(v) : v;
+        return s;
+}
+
+/**
+ * Set view from "X,Y,R": centre X + iY and radius R in the usual
+ * coordinates of the set, with as many digits as double-doubles hold.
+ * Returns 0 if s doesn't parse.
+ */
+int deep_parse_view(struct view *view, const char *s)
+{
+        struct dd x, y, r;
+
+        if (!(s = parse_dd(s, &x)) || *s++ != ','
+            || !(s = parse_dd(s, &y)) || *s++ != ','
+            || !(s = parse_dd(s, &r)) || *s
+            || !(r.hi > 0))
+                return 0;
+
+        /* Plane coordinates are twice c, see brot_count(). */
+        view_reset(view);
+        view->cx = 2 * x.hi;
+        view->cx_lo = 2 * x.lo;
+        view->cy = 2 * y.hi;
+        view->cy_lo = 2 * y.lo;
+        view->radius = 2 * r.hi;
+        if (view->radius < DEEP_MIN_RADIUS)
+                view->radius = DEEP_MIN_RADIUS;
+        return 1;
+}
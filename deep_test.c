@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <wayland-client.h>
+#include "simple.h"
+
+/*
+ * Perturbation must count what the exact pixel coordinates count. Near
+ * DEEP_PIXEL plain doubles round every pixel's coordinates by up to 1/4096
+ * of a pixel, which is enough to change the count of a few percent of the
+ * pixels near the boundary, so the reference here is the naive iteration
+ * in quad precision. Deep counts may differ from it in no more than
+ * MAX_BAD_PPM pixels per million, must be at least as close as doubles
+ * where those still render, and every kernel set must match the scalar
+ * one bit for bit.
+ *
+ * The views are centred on Misiurewicz points, which have structure at
+ * every scale without needing thousands of iterations.
+ */
+
+enum { WIDTH = 160, HEIGHT = 90, N_VIEWS = 3, MAX_ITER = 1000, MAX_BAD_PPM = 1000 };
+
+#ifdef __SIZEOF_FLOAT128__
+typedef __float128 quad;
+#else
+typedef long double quad;               /* Quad precision where there's no __float128 */
+#endif
+
+static const struct { double cx, cy; } centres[N_VIEWS] = {
+        { -1.5532211851994038, 0.26921792335005634 },
+        { -1.0125889163917785, 1.367983936178746 },
+        { -3.0873780253841527, 0.0 },
+};
+
+/* Pixel sizes, in DEEP_PIXEL. Doubles still render the first. */
+static const double pixels[] = { 4, 1.0 / 16 };
+
+static const char *const kernels[] = { "scalar", "avx2", "avx512" };
+
+static uint16_t want[N_VIEWS][HEIGHT][WIDTH];
+static uint16_t want_deep[N_VIEWS][HEIGHT][WIDTH];
+
+static struct view view_at(int v, double pixel)
+{
+        return (struct view){
+                .cx = centres[v].cx, .cy = centres[v].cy,
+                .radius = pixel * DEEP_PIXEL * HEIGHT / 2,
+        };
+}
+
+/* brot_count() without its shortcuts, in quad precision. */
+static int quad_count(quad x, quad y)
+{
+        quad x0 = x / 2, y0 = y / 2, zx = 0, zy = 0, xtemp;
+        int i = 0;
+
+        while (zx * zx + zy * zy < 4 && i < brot_max_iter) {
+                xtemp = zx * zx - zy * zy + x0;
+                zy = 2 * zx * zy + y0;
+                zx = xtemp;
+                i++;
+        }
+        return i;
+}
+
+/* Count view with the precision's kernel, BROT_DEEP relative to its centre. */
+static void render(uint16_t counts[HEIGHT][WIDTH], const struct view *view,
+                   enum brot_precision precision)
+{
+        double xs[WIDTH], pixel, x0, y0;
+        int x, y;
+
+        view_map(view, WIDTH, HEIGHT, &pixel, &x0, &y0);
+        if (precision == BROT_DEEP) {
+                x0 = -(double)WIDTH / 2.0 * pixel;
+                y0 = -(double)HEIGHT / 2.0 * pixel;
+                deep_reference(view);
+        }
+        for (x = 0; x < WIDTH; x++)
+                xs[x] = x * pixel + x0;
+        for (y = 0; y < HEIGHT; y++)
+                brot_spans[precision](counts[y], WIDTH, xs, y * pixel + y0);
+}
+
+/* Pixels of counts that differ from want. */
+static int differ(uint16_t counts[HEIGHT][WIDTH], uint16_t want[HEIGHT][WIDTH])
+{
+        int x, y, n = 0;
+
+        for (y = 0; y < HEIGHT; y++)
+                for (x = 0; x < WIDTH; x++)
+                        n += counts[y][x] != want[y][x];
+        return n;
+}
+
+int main(void)
+{
+        static uint16_t got[HEIGHT][WIDTH];
+        brot_span_fn scalar;
+        int failed = 0, i, p, v, x, y, bad, bad_double;
+
+        brot_max_iter = MAX_ITER;
+
+        for (p = 0; p < sizeof pixels / sizeof pixels[0]; p++) {
+                setenv("BROT_KERNEL", "scalar", 1);
+                brot_select_kernel();
+                scalar = brot_spans[BROT_DEEP];
+
+                for (v = 0; v < N_VIEWS; v++) {
+                        struct view view = view_at(v, pixels[p]);
+                        double pixel, x0, y0;
+
+                        view_map(&view, WIDTH, HEIGHT, &pixel, &x0, &y0);
+                        for (y = 0; y < HEIGHT; y++)
+                                for (x = 0; x < WIDTH; x++)
+                                        want[v][y][x] = quad_count(
+                                                (quad)view.cx + (quad)(x - WIDTH / 2) * pixel,
+                                                (quad)view.cy + (quad)(y - HEIGHT / 2) * pixel);
+
+                        render(want_deep[v], &view, BROT_DEEP);
+                        bad = differ(want_deep[v], want[v]);
+                        if ((long)bad * 1000000 > (long)MAX_BAD_PPM * WIDTH * HEIGHT) {
+                                printf("view %d at %g DEEP_PIXEL: %d pixels differ\n",
+                                       v, pixels[p], bad);
+                                failed = 1;
+                        }
+
+                        if (pixels[p] < 1)
+                                continue;
+                        render(got, &view, BROT_DOUBLE);
+                        bad_double = differ(got, want[v]);
+                        if (bad > bad_double) {
+                                printf("view %d at %g DEEP_PIXEL: %d pixels differ, "
+                                       "doubles only %d\n", v, pixels[p], bad, bad_double);
+                                failed = 1;
+                        }
+                }
+
+                for (i = 1; i < sizeof kernels / sizeof kernels[0]; i++) {
+                        setenv("BROT_KERNEL", kernels[i], 1);
+                        brot_select_kernel();
+                        if (brot_spans[BROT_DEEP] == scalar) {
+                                printf("%s: not supported, skipped\n", kernels[i]);
+                                continue;
+                        }
+                        for (v = 0; v < N_VIEWS; v++) {
+                                struct view view = view_at(v, pixels[p]);
+
+                                render(got, &view, BROT_DEEP);
+                                if (memcmp(got, want_deep[v], sizeof got) == 0)
+                                        continue;
+                                printf("%s: deep counts differ from scalar in view %d "
+                                       "at %g DEEP_PIXEL\n", kernels[i], v, pixels[p]);
+                                failed = 1;
+                        }
+                }
+        }
+
+        deep_destroy();
+        return failed;
+}
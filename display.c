@@ -45,6 +45,9 @@ static void output_scale(void *data,
 static void xdg_shell_ping(void *data,
                            struct xdg_shell *xdg_shell,
                            uint32_t serial);
+static void presentation_clock_id(void *data,
+                                  struct wp_presentation *presentation,
+                                  uint32_t clk_id);
 
 /* Listen's to messages from the  */
 const struct wl_registry_listener registry_listener = {
@@ -67,6 +70,10 @@ struct xdg_shell_listener xdg_shell_listener = {
         .ping = xdg_shell_ping
 };
 
+struct wp_presentation_listener presentation_listener = {
+        .clock_id = presentation_clock_id
+};
+
 /* Create a display object. Creating the nessasary wayland objects
  * and setting up the registry listener.
  */
@@ -86,6 +93,7 @@ struct my_display *create_display()
         }
 
         display->formats = 0;
+        display->presentation_clock = CLOCK_MONOTONIC;
         display->registry = wl_display_get_registry(display->display);
         wl_registry_add_listener(display->registry,
                                  &registry_listener,
@@ -128,11 +136,23 @@ void destroy_display(struct my_display *display)
                 display->shm = NULL;
         }
 
+        if (display->viewporter) {
+                wp_viewporter_destroy(display->viewporter);
+                display->viewporter = NULL;
+        }
+
+        if (display->presentation) {
+                wp_presentation_destroy(display->presentation);
+                display->presentation = NULL;
+        }
+
         if (display->output) {
                 wl_output_destroy(display->output);
                 display->output = NULL;
         }
 
+        input_destroy(display);
+
         wl_registry_destroy(display->registry); display->registry = NULL;
         wl_display_flush(display->display); 
         wl_display_disconnect(display->display); display->display = NULL;
@@ -164,6 +184,13 @@ static void registry_global(void *data,
                 d->xdg_shell = wl_registry_bind(registry, name, &xdg_shell_interface, version);
                 xdg_shell_add_listener(d->xdg_shell, &xdg_shell_listener, d);
                 xdg_shell_use_unstable_version(d->xdg_shell, XDG_SHELL_VERSION_CURRENT);
+        } else if (strcmp(interface, "wp_viewporter") == 0) {
+                /* viewporter for rendering below the window's size */
+                d->viewporter = wl_registry_bind(registry, name, &wp_viewporter_interface, 1);
+        } else if (strcmp(interface, "wp_presentation") == 0) {
+                /* presentation for when frames reach the screen */
+                d->presentation = wl_registry_bind(registry, name, &wp_presentation_interface, 1);
+                wp_presentation_add_listener(d->presentation, &presentation_listener, d);
         } else if (strcmp(interface, "wl_shell") == 0) {
                 /* For fall back. Don't use if xdg_shell is avaliable. */
                 d->shell = wl_registry_bind(registry, name, &wl_shell_interface, version);
@@ -176,6 +203,9 @@ static void registry_global(void *data,
                 } else {
                         printf("Observed new output but ignored it.\n");
                 }
+        } else if (strcmp(interface, "wl_seat") == 0) {
+                /* Pointer and keyboard to move the view */
+                input_bind(d, registry, name, version);
         }
         
 }
@@ -256,3 +286,12 @@ static void xdg_shell_ping(void *data,
 {
         xdg_shell_pong(xdg_shell, serial);
 }
+
+static void presentation_clock_id(void *data,
+                                  struct wp_presentation *presentation,
+                                  uint32_t clk_id)
+{
+        struct my_display *d = data;
+
+        d->presentation_clock = clk_id;
+}
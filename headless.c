@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/mman.h>
+
+#include <wayland-client.h>
+#include "simple.h"
+
+/*
+ * Headless mode.
+ *
+ * Renders frames into an anonymous mapping instead of a wl_buffer, so the
+ * renderers can be timed and checked without a compositor.
+ */
+
+static double elapsed_ms(const struct timespec *start, const struct timespec *end)
+{
+        return (end->tv_sec - start->tv_sec) * 1e3
+                + (end->tv_nsec - start->tv_nsec) / 1e6;
+}
+
+static int has_suffix(const char *s, const char *suffix)
+{
+        size_t n = strlen(s), m = strlen(suffix);
+
+        return n >= m && strcmp(s + n - m, suffix) == 0;
+}
+
+/*
+ * Write canvas to path. A .ppm file gets the image composited over white
+ * (the pixels are premultiplied ARGB), anything else gets the raw rows of
+ * ARGB8888 without stride padding.
+ */
+static int dump_canvas(const struct canvas *canvas, const char *path)
+{
+        FILE *f;
+        int32_t x, y;
+        int ppm = has_suffix(path, ".ppm");
+
+        f = fopen(path, "wb");
+        if (!f) {
+                perror(path);
+                return -1;
+        }
+
+        if (ppm)
+                fprintf(f, "P6\n%d %d\n255\n", canvas->width, canvas->height);
+
+        for (y = 0; y < canvas->height; y++) {
+                const struct pixel *row = (const struct pixel *)
+                        ((const char *)canvas->data + y * canvas->stride);
+
+                if (!ppm) {
+                        fwrite(row, sizeof *row, canvas->width, f);
+                        continue;
+                }
+                for (x = 0; x < canvas->width; x++) {
+                        unsigned char rgb[3];
+                        rgb[0] = row[x].r + (255 - row[x].a);
+                        rgb[1] = row[x].g + (255 - row[x].a);
+                        rgb[2] = row[x].b + (255 - row[x].a);
+                        fwrite(rgb, 1, 3, f);
+                }
+        }
+
+        if (fclose(f) != 0) {
+                perror(path);
+                return -1;
+        }
+        printf("Wrote %s\n", path);
+        return 0;
+}
+
+/**
+ * Render options->frames frames of options->width x options->height and
+ * print how long each took. Returns the exit status for main().
+ */
+int headless_run(const struct headless_options *options)
+{
+        struct worker_pool *workers;
+        struct canvas canvas;
+        struct damage damage;
+        struct timespec start, end;
+        size_t size;
+        double ms, total = 0, min = 0, max = 0;
+        int frame, status = 0;
+
+        canvas.width = options->width;
+        canvas.height = options->height;
+        canvas.stride = (canvas.width * 4 + CACHE_LINE - 1) & ~(CACHE_LINE - 1);
+        size = (size_t)canvas.stride * canvas.height;
+
+        canvas.data = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (canvas.data == MAP_FAILED) {
+                perror("Mmap failed");
+                return 1;
+        }
+
+        workers = worker_pool_create(options->threads);
+
+        printf("Rendering %d frames of %dx%d\n",
+               options->frames, canvas.width, canvas.height);
+
+        for (frame = 0; frame < options->frames; frame++) {
+                clock_gettime(CLOCK_MONOTONIC, &start);
+
+                /* One buffer, so only this frame's damage needs painting.
+                 * A still scene would paint nothing after the first
+                 * frame, so it starts over and every frame is timed
+                 * rendering all of it. */
+                damage_reset(&damage);
+                scene_update(workers, frame == 0 || renderer->still, &damage,
+                             canvas.width, canvas.height, 0);
+                render_frame(workers, &canvas, &damage);
+                if (renderer == &brot_renderer)
+                        palette_tick();
+
+                clock_gettime(CLOCK_MONOTONIC, &end);
+
+                ms = elapsed_ms(&start, &end);
+                printf("frame %d: %.3f ms\n", frame, ms);
+                total += ms;
+                if (frame == 0 || ms < min) min = ms;
+                if (frame == 0 || ms > max) max = ms;
+        }
+
+        if (options->frames > 0)
+                printf("frames: %d, min: %.3f ms, mean: %.3f ms, max: %.3f ms\n",
+                       options->frames, min, total / options->frames, max);
+
+        if (options->dump && dump_canvas(&canvas, options->dump) != 0)
+                status = 1;
+
+        worker_pool_destroy(workers);
+        munmap(canvas.data, size);
+
+        return status;
+}
@@ -0,0 +1,280 @@
+#include <math.h>
+#include <stdio.h>
+
+#include <linux/input-event-codes.h>
+#include <unistd.h>
+
+#include <wayland-client.h>
+#include "simple.h"
+
+/*
+ * Pointer and keyboard input, for moving the mandelbrot view around.
+ *
+ * Drag with the left button to pan, scroll to zoom in or out around the
+ * pointer. The arrow keys pan, + and - zoom around the middle of the
+ * window, Home goes back to the whole set and P switches to the next
+ * palette. Keys are read as raw evdev codes, so no keymap is needed.
+ *
+ * The view is in pixels of the buffers rendered, which are smaller than
+ * the window's when the render scale is down (see scale.c), so pointer
+ * positions are scaled into them.
+ *
+ * The render thread may be reading the view, so it is only changed under
+ * scene_lock.
+ */
+
+enum {
+        KEY_PAN_FRACTION = 8,         /**< Arrow keys pan by this fraction of the window. */
+};
+
+/* Zoom per wheel click (10 axis units) or key press. */
+#define ZOOM_STEP 1.25
+
+static struct {
+        double x, y;                  /* Pointer position in surface pixels */
+        int dragging;
+        double drag_x, drag_y;        /* Where the drag has been panned to */
+} pointer;
+
+/* Surface coordinates x, y in pixels of the next frame of window. */
+static void buffer_coords(const struct my_window *window, double *x, double *y)
+{
+        int32_t width, height;
+
+        scale_size(window, &width, &height);
+        *x = *x * width / window->width;
+        *y = *y * height / window->height;
+}
+
+/* Move the view and get it drawn. */
+static void view_changed(struct my_display *display)
+{
+        if (display->window)
+                redraw(display->window);
+}
+
+static void pointer_enter(void *data, struct wl_pointer *wl_pointer,
+                          uint32_t serial, struct wl_surface *surface,
+                          wl_fixed_t sx, wl_fixed_t sy)
+{
+        pointer.x = wl_fixed_to_double(sx);
+        pointer.y = wl_fixed_to_double(sy);
+}
+
+static void pointer_leave(void *data, struct wl_pointer *wl_pointer,
+                          uint32_t serial, struct wl_surface *surface)
+{
+        pointer.dragging = 0;
+}
+
+static void pointer_motion(void *data, struct wl_pointer *wl_pointer,
+                           uint32_t time, wl_fixed_t sx, wl_fixed_t sy)
+{
+        struct my_display *display = data;
+        struct my_window *window = display->window;
+        int32_t width, height, dx, dy;
+
+        pointer.x = wl_fixed_to_double(sx);
+        pointer.y = wl_fixed_to_double(sy);
+        if (!pointer.dragging || !window)
+                return;
+
+        /* Whole buffer pixels only, so the pixels still in view can be kept. */
+        scale_size(window, &width, &height);
+        dx = (int32_t)floor((pointer.drag_x - pointer.x) * width / window->width);
+        dy = (int32_t)floor((pointer.drag_y - pointer.y) * height / window->height);
+        if (!dx && !dy)
+                return;
+        pointer.drag_x -= (double)dx * window->width / width;
+        pointer.drag_y -= (double)dy * window->height / height;
+        pthread_mutex_lock(&scene_lock);
+        view_pan(&brot_view, dx, dy);
+        pthread_mutex_unlock(&scene_lock);
+        view_changed(display);
+}
+
+static void pointer_button(void *data, struct wl_pointer *wl_pointer,
+                           uint32_t serial, uint32_t time,
+                           uint32_t button, uint32_t state)
+{
+        if (button != BTN_LEFT)
+                return;
+
+        pointer.dragging = state == WL_POINTER_BUTTON_STATE_PRESSED;
+        pointer.drag_x = pointer.x;
+        pointer.drag_y = pointer.y;
+}
+
+static void pointer_axis(void *data, struct wl_pointer *wl_pointer,
+                         uint32_t time, uint32_t axis, wl_fixed_t value)
+{
+        struct my_display *display = data;
+        struct my_window *window = display->window;
+        int32_t width, height;
+        double x = pointer.x, y = pointer.y;
+
+        if (axis != WL_POINTER_AXIS_VERTICAL_SCROLL || !window)
+                return;
+
+        /* Scrolling down (positive) zooms out. */
+        scale_size(window, &width, &height);
+        buffer_coords(window, &x, &y);
+        pthread_mutex_lock(&scene_lock);
+        view_zoom(&brot_view, width, height,
+                  pow(ZOOM_STEP, -wl_fixed_to_double(value) / 10.0), x, y);
+        pthread_mutex_unlock(&scene_lock);
+        view_changed(display);
+}
+
+static const struct wl_pointer_listener pointer_listener = {
+        .enter  = pointer_enter,
+        .leave  = pointer_leave,
+        .motion = pointer_motion,
+        .button = pointer_button,
+        .axis   = pointer_axis,
+};
+
+static void keyboard_keymap(void *data, struct wl_keyboard *wl_keyboard,
+                            uint32_t format, int32_t fd, uint32_t size)
+{
+        /* Raw key codes will do. */
+        close(fd);
+}
+
+static void keyboard_enter(void *data, struct wl_keyboard *wl_keyboard,
+                           uint32_t serial, struct wl_surface *surface,
+                           struct wl_array *keys)
+{
+}
+
+static void keyboard_leave(void *data, struct wl_keyboard *wl_keyboard,
+                           uint32_t serial, struct wl_surface *surface)
+{
+}
+
+static void keyboard_key(void *data, struct wl_keyboard *wl_keyboard,
+                         uint32_t serial, uint32_t time,
+                         uint32_t key, uint32_t state)
+{
+        struct my_display *display = data;
+        struct my_window *window = display->window;
+        int32_t width, height, step_x, step_y;
+
+        if (state != WL_KEYBOARD_KEY_STATE_PRESSED || !window)
+                return;
+
+        scale_size(window, &width, &height);
+        step_x = width / KEY_PAN_FRACTION;
+        step_y = height / KEY_PAN_FRACTION;
+
+        pthread_mutex_lock(&scene_lock);
+        switch (key) {
+        case KEY_LEFT:
+                view_pan(&brot_view, -step_x, 0);
+                break;
+        case KEY_RIGHT:
+                view_pan(&brot_view, step_x, 0);
+                break;
+        case KEY_UP:
+                view_pan(&brot_view, 0, -step_y);
+                break;
+        case KEY_DOWN:
+                view_pan(&brot_view, 0, step_y);
+                break;
+        case KEY_EQUAL:
+        case KEY_KPPLUS:
+                view_zoom(&brot_view, width, height, ZOOM_STEP,
+                          width / 2.0, height / 2.0);
+                break;
+        case KEY_MINUS:
+        case KEY_KPMINUS:
+                view_zoom(&brot_view, width, height, 1.0 / ZOOM_STEP,
+                          width / 2.0, height / 2.0);
+                break;
+        case KEY_HOME:
+        case KEY_0:
+                view_reset(&brot_view);
+                break;
+        case KEY_P:
+                palette_id = (palette_id + 1) % N_PALETTES;
+                break;
+        default:
+                pthread_mutex_unlock(&scene_lock);
+                return;
+        }
+        pthread_mutex_unlock(&scene_lock);
+        view_changed(display);
+}
+
+static void keyboard_modifiers(void *data, struct wl_keyboard *wl_keyboard,
+                               uint32_t serial, uint32_t mods_depressed,
+                               uint32_t mods_latched, uint32_t mods_locked,
+                               uint32_t group)
+{
+}
+
+static const struct wl_keyboard_listener keyboard_listener = {
+        .keymap    = keyboard_keymap,
+        .enter     = keyboard_enter,
+        .leave     = keyboard_leave,
+        .key       = keyboard_key,
+        .modifiers = keyboard_modifiers,
+};
+
+static void seat_capabilities(void *data, struct wl_seat *seat, uint32_t caps)
+{
+        struct my_display *display = data;
+
+        if ((caps & WL_SEAT_CAPABILITY_POINTER) && !display->pointer) {
+                display->pointer = wl_seat_get_pointer(seat);
+                wl_pointer_add_listener(display->pointer, &pointer_listener, display);
+        } else if (!(caps & WL_SEAT_CAPABILITY_POINTER) && display->pointer) {
+                wl_pointer_destroy(display->pointer);
+                display->pointer = NULL;
+        }
+
+        if ((caps & WL_SEAT_CAPABILITY_KEYBOARD) && !display->keyboard) {
+                display->keyboard = wl_seat_get_keyboard(seat);
+                wl_keyboard_add_listener(display->keyboard, &keyboard_listener, display);
+        } else if (!(caps & WL_SEAT_CAPABILITY_KEYBOARD) && display->keyboard) {
+                wl_keyboard_destroy(display->keyboard);
+                display->keyboard = NULL;
+        }
+}
+
+static const struct wl_seat_listener seat_listener = {
+        .capabilities = seat_capabilities,
+};
+
+/**
+ * Bind the wl_seat global called name. Only the first seat is used.
+ */
+void input_bind(struct my_display *display, struct wl_registry *registry,
+                uint32_t name, uint32_t version)
+{
+        if (display->seat) {
+                printf("Observed new seat but ignored it.\n");
+                return;
+        }
+
+        /* Version 1 has everything used here, and no events we'd have to
+         * handle on top. */
+        display->seat = wl_registry_bind(registry, name, &wl_seat_interface, 1);
+        wl_seat_add_listener(display->seat, &seat_listener, display);
+}
+
+void input_destroy(struct my_display *display)
+{
+        if (display->pointer) {
+                wl_pointer_destroy(display->pointer);
+                display->pointer = NULL;
+        }
+        if (display->keyboard) {
+                wl_keyboard_destroy(display->keyboard);
+                display->keyboard = NULL;
+        }
+        if (display->seat) {
+                wl_seat_destroy(display->seat);
+                display->seat = NULL;
+        }
+}
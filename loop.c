@@ -0,0 +1,228 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <wayland-client.h>
+#include "simple.h"
+
+/*
+ * The main loop.
+ *
+ * One epoll set waits on everything the main thread answers to:
+ *
+ * - The Wayland socket. Events are read with wl_display_prepare_read()
+ *   and wl_display_read_events() and dispatched here, and requests are
+ *   flushed before every wait, waiting for the socket to take more if
+ *   it's full.
+ * - The window's render_fd, when the render thread has finished a frame
+ *   (see render_finish()).
+ * - A signalfd, for SIGINT and SIGTERM to quit, and SIGUSR1 to print the
+ *   frame timings.
+ * - A timerfd, printing the frame rate and presentation latency once a
+ *   second.
+ *
+ * Nothing here renders, so frame callbacks, buffer releases and signals
+ * are answered while the render thread is busy.
+ */
+
+enum loop_source {
+        SOURCE_DISPLAY,
+        SOURCE_RENDER,
+        SOURCE_SIGNAL,
+        SOURCE_TIMER,
+        N_SOURCES
+};
+
+/* Signals the loop reads from its signalfd. */
+static void loop_signals(sigset_t *mask)
+{
+        sigemptyset(mask);
+        sigaddset(mask, SIGINT);
+        sigaddset(mask, SIGTERM);
+        if (trace_enabled)
+                sigaddset(mask, SIGUSR1);
+}
+
+/**
+ * Block the signals loop_run() handles, so only its signalfd sees them.
+ * Call before any thread is started, threads inherit the mask.
+ */
+void loop_block_signals(void)
+{
+        sigset_t mask;
+
+        loop_signals(&mask);
+        pthread_sigmask(SIG_BLOCK, &mask, NULL);
+}
+
+static int watch(int epoll_fd, int op, int fd, enum loop_source source, uint32_t events)
+{
+        struct epoll_event event = { .events = events, .data.u32 = source };
+
+        return epoll_ctl(epoll_fd, op, fd, &event);
+}
+
+/*
+ * Print the frames committed in the last second, if any, and with
+ * presentation feedback how long they took to reach the screen.
+ */
+static void report_fps(struct my_window *window)
+{
+        static unsigned frame, stalls;
+        struct present_stats *present = &window->present;
+
+        if (window->frame != frame) {
+                printf("fps = %u", window->frame - frame);
+                if (window->stalls != stalls)
+                        printf(", stalls = %u", window->stalls - stalls);
+                if (present->presented)
+                        printf(", latency = %.1f ms (max %.1f), missed = %u",
+                               present->latency_ns / 1e6 / present->presented,
+                               present->max_latency_ns / 1e6, present->missed);
+                if (present->discarded)
+                        printf(", discarded = %u", present->discarded);
+                printf("\n");
+        }
+        frame = window->frame;
+        stalls = window->stalls;
+        *present = (struct present_stats){ 0 };
+}
+
+/* Act on a signal read from the signalfd. Returns 0 to quit. */
+static int handle_signal(int signal_fd)
+{
+        struct signalfd_siginfo info;
+        int running = 1;
+
+        while (read(signal_fd, &info, sizeof info) == sizeof info) {
+                if (info.ssi_signo == SIGUSR1)
+                        trace_dump(stdout);
+                else
+                        running = 0;
+        }
+        return running;
+}
+
+/* The main loop's file descriptors. */
+struct loop {
+        struct wl_display *display;
+        struct my_window *window;
+        int display_fd, epoll_fd, signal_fd, timer_fd;
+        int blocked;                    /* Waiting for the socket to take writes */
+};
+
+/*
+ * Wait for something to happen and handle it. Returns 1 to go on, 0 to
+ * quit and -1 if the display connection failed.
+ */
+static int loop_iterate(struct loop *loop)
+{
+        struct epoll_event events[N_SOURCES];
+        uint64_t expirations;
+        int running = 1, readable = 0;
+        int i, n;
+
+        /* Only an empty queue may be read into. */
+        while (wl_display_prepare_read(loop->display) != 0) {
+                if (wl_display_dispatch_pending(loop->display) < 0)
+                        return -1;
+        }
+
+        /* A full socket is written out once it drains. */
+        if (wl_display_flush(loop->display) < 0) {
+                if (errno != EAGAIN) {
+                        wl_display_cancel_read(loop->display);
+                        return -1;
+                }
+                if (!loop->blocked) {
+                        loop->blocked = 1;
+                        watch(loop->epoll_fd, EPOLL_CTL_MOD, loop->display_fd,
+                              SOURCE_DISPLAY, EPOLLIN | EPOLLOUT);
+                }
+        }
+
+        n = epoll_wait(loop->epoll_fd, events, N_SOURCES, -1);
+        if (n < 0) {
+                wl_display_cancel_read(loop->display);
+                return errno == EINTR ? 1 : -1;
+        }
+
+        for (i = 0; i < n; i++) {
+                if (events[i].data.u32 != SOURCE_DISPLAY)
+                        continue;
+                readable = events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP);
+                if ((events[i].events & EPOLLOUT) && wl_display_flush(loop->display) >= 0) {
+                        loop->blocked = 0;
+                        watch(loop->epoll_fd, EPOLL_CTL_MOD, loop->display_fd,
+                              SOURCE_DISPLAY, EPOLLIN);
+                }
+        }
+        if (readable) {
+                if (wl_display_read_events(loop->display) < 0)
+                        return -1;
+        } else {
+                wl_display_cancel_read(loop->display);
+        }
+        if (wl_display_dispatch_pending(loop->display) < 0)
+                return -1;
+
+        for (i = 0; i < n; i++) {
+                switch (events[i].data.u32) {
+                case SOURCE_RENDER:
+                        render_finish(loop->window);
+                        break;
+                case SOURCE_SIGNAL:
+                        running = handle_signal(loop->signal_fd);
+                        break;
+                case SOURCE_TIMER:
+                        if (read(loop->timer_fd, &expirations, sizeof expirations) > 0)
+                                report_fps(loop->window);
+                        break;
+                }
+        }
+        return running;
+}
+
+/**
+ * Run display and window until a signal says to quit (returning 0) or the
+ * connection fails (-1).
+ */
+int loop_run(struct my_display *display, struct my_window *window)
+{
+        static const struct itimerspec second = { { 1, 0 }, { 1, 0 } };
+        struct loop loop = { display->display, window };
+        sigset_t mask;
+        int status;
+
+        loop_signals(&mask);
+        loop.display_fd = wl_display_get_fd(display->display);
+        loop.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        loop.signal_fd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+        loop.timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+        if (loop.epoll_fd < 0 || loop.signal_fd < 0 || loop.timer_fd < 0
+            || timerfd_settime(loop.timer_fd, 0, &second, NULL) < 0
+            || watch(loop.epoll_fd, EPOLL_CTL_ADD, loop.display_fd, SOURCE_DISPLAY, EPOLLIN) < 0
+            || watch(loop.epoll_fd, EPOLL_CTL_ADD, window->render_fd, SOURCE_RENDER, EPOLLIN) < 0
+            || watch(loop.epoll_fd, EPOLL_CTL_ADD, loop.signal_fd, SOURCE_SIGNAL, EPOLLIN) < 0
+            || watch(loop.epoll_fd, EPOLL_CTL_ADD, loop.timer_fd, SOURCE_TIMER, EPOLLIN) < 0) {
+                perror("Failed to set up the main loop");
+                exit(1);
+        }
+
+        while ((status = loop_iterate(&loop)) > 0)
+                ;
+        if (status < 0)
+                fprintf(stderr, "Lost the display: %s\n", strerror(errno));
+
+        close(loop.timer_fd);
+        close(loop.signal_fd);
+        close(loop.epoll_fd);
+        return status;
+}
@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <wayland-client.h>
+#include "simple.h"
+
+/*
+ * The grid culled metaballs must paint exactly what paint_meta_pixel()
+ * does, with every kernel, with and without the approximate reciprocal,
+ * for a few ball counts and window shapes. Kernels the CPU lacks fall
+ * back to scalar, which is tested again.
+ */
+
+enum { FRAMES = 20 };
+
+static const char *const kernels[] = { "scalar", "avx2", "avx512" };
+static const int ball_counts[] = { META_BALLS, 1000, META_MAX_BALLS };
+static const struct { int32_t width, height; } sizes[] = {
+        { 203, 117 }, { 77, 301 }, { 997, 3 },
+};
+
+/* Paint the canvas tile by tile, as meta_render_tile() does. */
+static void paint(struct pixel *data, int32_t width, int32_t height,
+                  const double *xs, double max_yy)
+{
+        struct meta_tile tile;
+        int32_t tx, tx_end, y0, y1, y;
+
+        meta_tile_alloc(&tile);
+        for (y0 = 0; y0 < height; y0 += BAND_ROWS) {
+                y1 = y0 + BAND_ROWS < height ? y0 + BAND_ROWS : height;
+                for (tx = 0; tx < width; tx += META_TILE) {
+                        tx_end = tx + META_TILE < width ? tx + META_TILE : width;
+                        meta_tile_init(&tile, xs[tx], (2.0 * y0 / height - 1.0) * max_yy,
+                                       xs[tx_end - 1], (2.0 * (y1 - 1) / height - 1.0) * max_yy);
+                        for (y = y0; y < y1; y++)
+                                meta_paint_span(&tile, data + y * width, tx, tx_end, xs,
+                                                (2.0 * y / height - 1.0) * max_yy);
+                }
+        }
+        meta_tile_free(&tile);
+}
+
+/* Number of pixels that differ from paint_meta_pixel(). */
+static int check(int32_t width, int32_t height)
+{
+        struct pixel *got, want;
+        double max_xx, max_yy, *xs;
+        int32_t x, y;
+        int frame, bad = 0;
+
+        if (posix_memalign((void **)&got, CACHE_LINE,
+                           (size_t)width * height * sizeof *got) != 0)
+                got = NULL;
+        xs = malloc(width * sizeof *xs);
+        if (!got || !xs) {
+                perror(""); exit(1);
+        }
+
+        viewport_extents(width, height, &max_xx, &max_yy);
+        for (x = 0; x < width; x++)
+                xs[x] = (2.0 * x / width - 1.0) * max_xx;
+
+        srand(1);
+        for (frame = 0; frame < FRAMES; frame++) {
+                struct damage damage;
+
+                damage_reset(&damage);
+                meta_update(frame == 0, &damage, width, height, max_xx, max_yy);
+                if (frame % 5 != 0)
+                        continue;
+
+                paint(got, width, height, xs, max_yy);
+                for (y = 0; y < height; y++) {
+                        for (x = 0; x < width; x++) {
+                                paint_meta_pixel(&want, xs[x], (2.0 * y / height - 1.0) * max_yy);
+                                bad += memcmp(&got[y * width + x], &want, sizeof want) != 0;
+                        }
+                }
+        }
+
+        free(xs);
+        free(got);
+        return bad;
+}
+
+int main(void)
+{
+        int k, rcp, b, s, bad, failed = 0;
+
+        for (k = 0; k < sizeof kernels / sizeof kernels[0]; k++) {
+                for (rcp = 0; rcp < 2; rcp++) {
+                        setenv("META_KERNEL", kernels[k], 1);
+                        setenv("META_RCP", rcp ? "1" : "0", 1);
+                        for (b = 0; b < sizeof ball_counts / sizeof ball_counts[0]; b++) {
+                                meta_balls = ball_counts[b];
+                                meta_renderer.init();
+                                for (s = 0; s < sizeof sizes / sizeof sizes[0]; s++) {
+                                        bad = check(sizes[s].width, sizes[s].height);
+                                        if (!bad)
+                                                continue;
+                                        printf("%s, META_RCP=%d, %d balls, %dx%d: "
+                                               "%d pixels differ\n",
+                                               kernels[k], rcp, ball_counts[b],
+                                               sizes[s].width, sizes[s].height, bad);
+                                        failed = 1;
+                                }
+                                meta_renderer.destroy();
+                        }
+                }
+        }
+
+        return failed;
+}
@@ -0,0 +1,916 @@
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define META_X86
+#endif
+
+#include <wayland-client.h>
+#include "simple.h"
+
+/*
+ * Metaballs.
+ *
+ * A pixel is lit when the field, the sum of 1/d^2 over every ball, is
+ * above meta_threshold, 255 for the default META_BALLS balls. The
+ * threshold grows with the number of balls, so --balls N draws N smaller
+ * balls covering the same area as the default ones. paint_meta_pixel()
+ * is the brute force reference.
+ *
+ * To avoid summing every ball at every pixel the balls are binned into a
+ * uniform grid each frame. For a tile of pixels the balls whose term
+ * varies a lot over the tile are "near" and are summed per pixel, the
+ * rest only contribute a lower and an upper bound (per cell where the
+ * cell is far enough, count / distance^2 to its nearest and furthest
+ * point). If the near sum plus the lower bound is over the threshold, or
+ * the near sum plus the upper bound is clearly under it, the pixel is
+ * decided. Otherwise we fall back to the brute force sum, so the output
+ * is identical to paint_meta_pixel().
+ *
+ * The vector kernels sum the near balls for 8 (AVX2) or 16 (AVX-512)
+ * pixels at once in float, by default with the CPU's approximate
+ * reciprocal in place of a division. That sum is only good to within
+ * META_MARGIN of the double one, so it has to clear the threshold by that
+ * much to decide a pixel. Pixels it can't decide get a float sum over
+ * every ball, 8 or 16 balls at a time, and only the few closer than
+ * META_MARGIN to the edge of a ball get the brute force sum. The output is still
+ * identical.
+ *
+ * Ball state is kept as an array per coordinate (struct metaballs), and
+ * a tile's list of near balls is on the heap (meta_tile_alloc()), as
+ * there can be thousands.
+ *
+ * Pixels are written with non-temporal stores, see stream_pixel().
+ */
+
+#define SQR(_X) ((_X)*(_X))
+
+struct metaballs global_balls;
+int meta_balls = META_BALLS;
+
+/* Field over which a pixel is lit. */
+static double meta_threshold = 255;
+/* Most a far cell or ball's term may vary over a tile, as a fraction of
+ * meta_threshold. */
+static const double FAR_SPREAD = 1.0 / 256;
+/* Slack for rounding when comparing bounds to the threshold. */
+static const double BOUND_SLACK = 1e-6;
+/*
+ * Most the vector kernels' float sum can be off from the double one, as a
+ * fraction of it. Terms that matter are from balls at least
+ * r = 1/sqrt(meta_threshold) away. Float coordinates relative to the tile
+ * keep 1/d^2 of those to about 2^-22 * (tile width / r + 1), which
+ * meta_tile_init() holds to a quarter of the margin by leaving very wide
+ * tiles (windows a few pixels high) to the scalar kernel. Adding up to
+ * META_MAX_BALLS terms in float loses up to 2^-12, and the approximate
+ * reciprocal up to 1.5 * 2^-12 (AVX2) or 2^-14 (AVX-512).
+ */
+static const double META_MARGIN = 1e-3;
+
+struct box {
+        double x0, y0, x1, y1;
+};
+
+/* What a pixel is painted, lit or not. */
+static const struct pixel META_LIT = { 0, 255, 0, 255 };
+static const struct pixel META_DARK = { 0, 0, 0, 0 };
+
+static struct meta_grid {
+        int n;                  /* Cells per side */
+        double x0, y0;          /* Corner of cell 0 */
+        double cell_w, cell_h;
+        int *start;             /* Balls of cell c are index[start[c]..start[c+1]) */
+        int *next;              /* Fill position while building */
+        int *index;             /* Ball indices, ascending within a cell */
+        int *cell;              /* Cell of each ball */
+        struct box *bounds;     /* Bounding box of the balls in each cell */
+} grid;
+
+void paint_meta_pixel(struct pixel *pixel, double x, double y)
+{
+        int i;
+        double sum = 0.0;
+
+        for (i = 0; i < global_balls.n; i++)
+                sum += 1.0 / (SQR(x - global_balls.x[i]) + SQR(y - global_balls.y[i]));
+
+        pixel->b = 0;
+        pixel->a = (sum > meta_threshold) ? 255 : 0;
+        pixel->r = 0;
+        pixel->g = (sum > meta_threshold) ? 255 : 0;
+}
+
+/*
+ * Pixels that may change when a ball moves from (x0, y0) to (x1, y1).
+ *
+ * A pixel can only be lit if the field sums past meta_threshold, which
+ * needs at least one ball with 1/d^2 > meta_threshold / n. The threshold
+ * grows with n, so that reach is sqrt(META_BALLS / 255) however many
+ * balls there are, and nothing further than it from every ball can
+ * change.
+ */
+static struct rect ball_damage(double x0, double y0, double x1, double y1,
+                               int32_t width, int32_t height,
+                               double max_xx, double max_yy)
+{
+        const double reach = sqrt(global_balls.n / meta_threshold);
+        struct rect rect;
+        int32_t left, right, top, bottom;
+
+        /* Inverse of the pixel to cartesian mapping in draw(). */
+        left   = floor((( (x0 < x1 ? x0 : x1) - reach) / max_xx + 1.0) * width / 2);
+        right  = ceil(( ( (x0 > x1 ? x0 : x1) + reach) / max_xx + 1.0) * width / 2) + 1;
+        top    = floor((( (y0 < y1 ? y0 : y1) - reach) / max_yy + 1.0) * height / 2);
+        bottom = ceil(( ( (y0 > y1 ? y0 : y1) + reach) / max_yy + 1.0) * height / 2) + 1;
+
+        if (left < 0) left = 0;
+        if (top < 0) top = 0;
+        if (right > width) right = width;
+        if (bottom > height) bottom = height;
+
+        rect.x = left;
+        rect.y = top;
+        rect.width = right - left;
+        rect.height = bottom - top;
+        return rect;
+}
+
+/*
+ * Ball arrays for meta_balls balls and a grid of roughly four balls per
+ * cell.
+ */
+static void meta_alloc(void)
+{
+        struct metaballs *balls = &global_balls;
+        size_t size = (meta_balls * sizeof(double) + CACHE_LINE - 1) & ~(size_t)(CACHE_LINE - 1);
+        size_t n_pad = (meta_balls + META_LANES - 1) / META_LANES * META_LANES;
+        char *block;
+        int i, n_cells;
+
+        if (posix_memalign((void **)&block, CACHE_LINE,
+                           4 * size + 2 * n_pad * sizeof(float)) != 0) {
+                perror(""); exit(1);
+        }
+        balls->n = meta_balls;
+        balls->x = (double *)block;
+        balls->y = (double *)(block + size);
+        balls->dx = (double *)(block + 2 * size);
+        balls->dy = (double *)(block + 3 * size);
+        balls->fx = (float *)(block + 4 * size);
+        balls->fy = balls->fx + n_pad;
+        /* Padding balls too far away to add anything */
+        for (i = balls->n; i < n_pad; i++)
+                balls->fx[i] = balls->fy[i] = 1e15f;
+        meta_threshold = 255.0 * balls->n / META_BALLS;
+
+        grid.n = ceil(sqrt(balls->n / 4.0));
+        if (grid.n > 64)
+                grid.n = 64;
+        if (grid.n < 1)
+                grid.n = 1;
+        n_cells = grid.n * grid.n;
+        grid.start = calloc(n_cells + 1, sizeof *grid.start);
+        grid.next = calloc(n_cells, sizeof *grid.next);
+        grid.index = calloc(balls->n, sizeof *grid.index);
+        grid.cell = calloc(balls->n, sizeof *grid.cell);
+        grid.bounds = calloc(n_cells, sizeof *grid.bounds);
+        if (!grid.start || !grid.next || !grid.index
+            || !grid.cell || !grid.bounds) {
+                perror(""); exit(1);
+        }
+}
+
+static void grid_build(void)
+{
+        struct box all = { INFINITY, INFINITY, -INFINITY, -INFINITY };
+        int i, c, cx, cy, n_cells;
+
+        n_cells = grid.n * grid.n;
+
+        for (i = 0; i < global_balls.n; i++) {
+                global_balls.fx[i] = global_balls.x[i];
+                global_balls.fy[i] = global_balls.y[i];
+                if (global_balls.x[i] < all.x0) all.x0 = global_balls.x[i];
+                if (global_balls.y[i] < all.y0) all.y0 = global_balls.y[i];
+                if (global_balls.x[i] > all.x1) all.x1 = global_balls.x[i];
+                if (global_balls.y[i] > all.y1) all.y1 = global_balls.y[i];
+        }
+
+        grid.x0 = all.x0;
+        grid.y0 = all.y0;
+        grid.cell_w = (all.x1 - all.x0) / grid.n;
+        grid.cell_h = (all.y1 - all.y0) / grid.n;
+
+        for (c = 0; c <= n_cells; c++)
+                grid.start[c] = 0;
+        for (c = 0; c < n_cells; c++) {
+                grid.bounds[c].x0 = grid.bounds[c].y0 = INFINITY;
+                grid.bounds[c].x1 = grid.bounds[c].y1 = -INFINITY;
+        }
+
+        /* Counting sort by cell, which keeps indices ascending in a cell.
+         * Cells only need to be roughly right, the bounds are exact. */
+        for (i = 0; i < global_balls.n; i++) {
+                double x = global_balls.x[i], y = global_balls.y[i];
+                struct box *b;
+
+                cx = grid.cell_w > 0 ? (x - grid.x0) / grid.cell_w : 0;
+                cy = grid.cell_h > 0 ? (y - grid.y0) / grid.cell_h : 0;
+                if (cx >= grid.n) cx = grid.n - 1;
+                if (cy >= grid.n) cy = grid.n - 1;
+                c = cy * grid.n + cx;
+                grid.cell[i] = c;
+                grid.start[c + 1]++;
+
+                b = &grid.bounds[c];
+                if (x < b->x0) b->x0 = x;
+                if (y < b->y0) b->y0 = y;
+                if (x > b->x1) b->x1 = x;
+                if (y > b->y1) b->y1 = y;
+        }
+        for (c = 0; c < n_cells; c++) {
+                grid.start[c + 1] += grid.start[c];
+                grid.next[c] = grid.start[c];
+        }
+        for (i = 0; i < global_balls.n; i++)
+                grid.index[grid.next[grid.cell[i]]++] = i;
+}
+
+/**
+ * Move the balls one step, or scatter them if first is set, and record
+ * the pixels that changed in damage.
+ */
+void meta_update(int first, struct damage *damage,
+                 int32_t width, int32_t height,
+                 double max_xx, double max_yy)
+{
+        struct metaballs *balls = &global_balls;
+        int i;
+
+        for (i = 0; i < balls->n; i++) {
+                double old_x = balls->x[i], old_y = balls->y[i];
+
+                if (first) {
+                        const double MAX_SPEED = 0.005;
+
+                        /* First call, setup metaballs */
+                        balls->x[i]  = 2.0 * (double)rand()/RAND_MAX - 1.0;
+                        balls->y[i]  = 2.0 * (double)rand()/RAND_MAX - 1.0;
+                        balls->dx[i] = 2 * MAX_SPEED * (double)rand()/RAND_MAX - MAX_SPEED;
+                        balls->dy[i] = 2 * MAX_SPEED * (double)rand()/RAND_MAX - MAX_SPEED;
+                } else {
+                        /* Update balls */
+                        balls->x[i] += balls->dx[i];
+                        balls->y[i] += balls->dy[i];
+
+                        if (balls->x[i] > 1.0 || balls->x[i] < -1.0)
+                                balls->dx[i] *= -1;
+                        if (balls->y[i] > 1.0 || balls->y[i] < -1.0)
+                                balls->dy[i] *= -1;
+
+                        damage_add(damage,
+                                   ball_damage(old_x, old_y, balls->x[i], balls->y[i],
+                                               width, height, max_xx, max_yy));
+                }
+        }
+        if (first)
+                damage_all(damage);
+
+        grid_build();
+}
+
+static double box_dist2(const struct box *a, const struct box *b)
+{
+        double dx = 0, dy = 0;
+
+        if (b->x1 < a->x0) dx = a->x0 - b->x1;
+        else if (b->x0 > a->x1) dx = b->x0 - a->x1;
+        if (b->y1 < a->y0) dy = a->y0 - b->y1;
+        else if (b->y0 > a->y1) dy = b->y0 - a->y1;
+
+        return SQR(dx) + SQR(dy);
+}
+
+static int int_compare(const void *a_, const void *b_)
+{
+        int a = *(const int *)a_, b = *(const int *)b_;
+
+        return (a > b) - (a < b);
+}
+
+/**
+ * Room in tile for every ball to be near. Free it with meta_tile_free().
+ */
+void meta_tile_alloc(struct meta_tile *tile)
+{
+        size_t n = (global_balls.n + CACHE_LINE - 1) & ~(size_t)(CACHE_LINE - 1);
+
+        if (posix_memalign((void **)&tile->near_x, CACHE_LINE,
+                           n * (sizeof *tile->near_x + sizeof *tile->dy2
+                                + sizeof *tile->near)) != 0) {
+                perror(""); exit(1);
+        }
+        tile->dy2 = tile->near_x + n;
+        tile->near = (int *)(tile->dy2 + n);
+        tile->n_near = 0;
+        tile->capacity = global_balls.n;
+}
+
+void meta_tile_free(struct meta_tile *tile)
+{
+        free(tile->near_x);
+        tile->near_x = tile->dy2 = NULL;
+        tile->near = NULL;
+        tile->capacity = 0;
+}
+
+/* Each render thread's tile, kept from band to band, freed when it exits. */
+static pthread_key_t thread_tile_key;
+static pthread_once_t thread_tile_once = PTHREAD_ONCE_INIT;
+
+static void thread_tile_destroy(void *tile)
+{
+        meta_tile_free(tile);
+        free(tile);
+}
+
+static void thread_tile_key_create(void)
+{
+        if (pthread_key_create(&thread_tile_key, thread_tile_destroy) != 0) {
+                perror("Failed to create tile key"); exit(1);
+        }
+}
+
+/* The calling thread's tile, grown if there are more balls than it fits. */
+static struct meta_tile *thread_tile(void)
+{
+        struct meta_tile *tile;
+
+        pthread_once(&thread_tile_once, thread_tile_key_create);
+        tile = pthread_getspecific(thread_tile_key);
+        if (!tile) {
+                tile = calloc(1, sizeof *tile);
+                if (!tile || pthread_setspecific(thread_tile_key, tile) != 0) {
+                        perror(""); exit(1);
+                }
+        }
+        if (tile->capacity < global_balls.n) {
+                meta_tile_free(tile);
+                meta_tile_alloc(tile);
+        }
+        return tile;
+}
+
+/* Squared distance between the furthest points of a and b. */
+static double box_far2(const struct box *a, const struct box *b)
+{
+        double dx = fmax(a->x1 - b->x0, b->x1 - a->x0);
+        double dy = fmax(a->y1 - b->y0, b->y1 - a->y0);
+
+        return SQR(dx) + SQR(dy);
+}
+
+/**
+ * Split the balls into those that must be summed for pixels inside
+ * [x0, x1] x [y0, y1] and bounds on what the rest add.
+ *
+ * A cell, or failing that a ball, is far when what it adds varies by at
+ * most FAR_SPREAD of the threshold over the tile. Far balls then add
+ * between far_lower and far_bound everywhere in it.
+ */
+void meta_tile_init(struct meta_tile *tile,
+                    double x0, double y0, double x1, double y1)
+{
+        const struct box area = { x0, y0, x1, y1 };
+        const double spread = FAR_SPREAD * meta_threshold;
+        int n_cells = grid.n * grid.n;
+        int c, i, count, ball;
+        double d2, far2, limit;
+
+        tile->n_near = 0;
+        tile->far_bound = 0;
+        tile->far_lower = 0;
+
+        for (c = 0; c < n_cells; c++) {
+                count = grid.start[c + 1] - grid.start[c];
+                if (!count)
+                        continue;
+
+                d2 = box_dist2(&area, &grid.bounds[c]);
+                far2 = box_far2(&area, &grid.bounds[c]);
+                if (d2 > 0 && count * (1 / d2 - 1 / far2) <= spread) {
+                        tile->far_bound += count / d2;
+                        tile->far_lower += count / far2;
+                        continue;
+                }
+
+                for (i = grid.start[c]; i < grid.start[c + 1]; i++) {
+                        struct box at;
+
+                        ball = grid.index[i];
+                        at.x0 = at.x1 = global_balls.x[ball];
+                        at.y0 = at.y1 = global_balls.y[ball];
+                        d2 = box_dist2(&area, &at);
+                        far2 = box_far2(&area, &at);
+                        if (d2 > 0 && 1 / d2 - 1 / far2 <= spread) {
+                                tile->far_bound += 1 / d2;
+                                tile->far_lower += 1 / far2;
+                        } else {
+                                tile->near[tile->n_near++] = ball;
+                        }
+                }
+        }
+
+        /* Sum in the same order as the reference so the near sum never
+         * rounds above the full one. */
+        qsort(tile->near, tile->n_near, sizeof *tile->near, int_compare);
+
+        /* Near x relative to the tile, so float keeps the differences. */
+        tile->origin_x = (x0 + x1) / 2;
+        tile->vector = 0x1p-22 * ((x1 - x0) * sqrt(meta_threshold) + 1) <= META_MARGIN / 4;
+        for (i = 0; i < tile->n_near; i++)
+                tile->near_x[i] = global_balls.x[tile->near[i]] - tile->origin_x;
+
+        /* What the lit and dark tests in meta_span_scalar() become with
+         * the float sum up to META_MARGIN off, rounded outwards to a float. */
+        tile->lit_sum = meta_threshold * (1 + BOUND_SLACK) - tile->far_lower;
+        limit = tile->lit_sum * (1 + META_MARGIN);
+        tile->lit_limit = limit;
+        if (tile->lit_limit < limit)
+                tile->lit_limit = nextafterf(tile->lit_limit, INFINITY);
+        limit = ((meta_threshold / (1 + BOUND_SLACK)) - tile->far_bound) / (1 + META_MARGIN);
+        tile->dark_limit = limit;
+        if (tile->dark_limit > limit)
+                tile->dark_limit = nextafterf(tile->dark_limit, -INFINITY);
+}
+
+static inline int pixel_bits(struct pixel p)
+{
+        int v;
+
+        memcpy(&v, &p, sizeof v);
+        return v;
+}
+
+/*
+ * Store p without reading its cache line in first. Nothing reads the frame
+ * back before the compositor, and a tile's span of a row is whole cache
+ * lines (rows start on one, see CACHE_LINE), so this only saves traffic.
+ */
+static inline void stream_pixel(struct pixel *dst, struct pixel p)
+{
+#ifdef __SSE2__
+        _mm_stream_si32((int *)dst, pixel_bits(p));
+#else
+        *dst = p;
+#endif
+}
+
+/* Whether the vector kernels may use an approximate reciprocal. */
+static int meta_rcp = 1;
+
+typedef void (*meta_span_fn)(const struct meta_tile *tile,
+                             struct pixel *row, int32_t x0, int32_t x1,
+                             const double *xs, double y);
+
+static void meta_span_scalar(const struct meta_tile *tile,
+                             struct pixel *row, int32_t x0, int32_t x1,
+                             const double *xs, double y)
+{
+        struct pixel pixel;
+        int32_t x;
+        int i;
+
+        for (x = x0; x < x1; x++) {
+                double sum = 0.0;
+
+                /* Terms are positive, once past the threshold the pixel is lit. */
+                for (i = 0; i < tile->n_near && sum <= tile->lit_sum; i++) {
+                        int ball = tile->near[i];
+                        sum += 1.0 / (SQR(xs[x] - global_balls.x[ball])
+                                      + SQR(y - global_balls.y[ball]));
+                }
+
+                if (sum > meta_threshold || sum > tile->lit_sum)
+                        pixel = META_LIT;
+                else if ((sum + tile->far_bound) * (1 + BOUND_SLACK) <= meta_threshold)
+                        pixel = META_DARK;
+                else
+                        paint_meta_pixel(&pixel, xs[x], y);
+                stream_pixel(&row[x], pixel);
+        }
+#ifdef __SSE2__
+        _mm_sfence();
+#endif
+}
+
+#ifdef META_X86
+
+/*
+ * The vertical distances squared from row y to each near ball, the same
+ * for every pixel of a span, into tile->dy2. In double, so only the
+ * result is rounded.
+ */
+static void meta_span_dy2(const struct meta_tile *tile, double y)
+{
+        int i;
+
+        for (i = 0; i < tile->n_near; i++)
+                tile->dy2[i] = SQR(y - global_balls.y[tile->near[i]]);
+}
+
+/* A float sum over every ball over this is lit, at most this dark. */
+static float meta_lit_all, meta_dark_all;
+
+typedef struct pixel (*meta_pixel_fn)(double x, double y);
+
+/*
+ * Write n pixels from row[x], given bit masks of the lanes the float sum
+ * found lit and dark. The rest are too close to call from the tile's
+ * bounds and get a float sum over every ball from pixel_all.
+ */
+static inline void meta_store_lanes(struct pixel *row, int32_t x, int n,
+                                    unsigned lit, unsigned dark,
+                                    const double *xs, double y,
+                                    meta_pixel_fn pixel_all)
+{
+        struct pixel pixel;
+        int lane;
+
+        for (lane = 0; lane < n; lane++) {
+                if (lit & 1u << lane)
+                        pixel = META_LIT;
+                else if (dark & 1u << lane)
+                        pixel = META_DARK;
+                else
+                        pixel = pixel_all(xs[x + lane], y);
+                stream_pixel(&row[x + lane], pixel);
+        }
+}
+
+/* paint_meta_pixel() is SSE code, slow with the upper halves of the
+ * vector registers dirty. */
+__attribute__((target("avx")))
+static struct pixel meta_pixel_exact(double x, double y)
+{
+        struct pixel pixel;
+
+        _mm256_zeroupper();
+        paint_meta_pixel(&pixel, x, y);
+        return pixel;
+}
+
+/*
+ * The pixel at (x, y) from a float sum over every ball, 8 at a time in
+ * separate lanes, or the brute force sum if that's within META_MARGIN
+ * of the threshold. Ball coordinates are global_balls.fx and fy, padded
+ * to a multiple of META_LANES with balls too far away to count.
+ */
+__attribute__((target("avx2,fma")))
+static struct pixel meta_pixel_all_avx2(double x, double y)
+{
+        const __m256 px = _mm256_set1_ps(x), py = _mm256_set1_ps(y);
+        __m256 sum = _mm256_setzero_ps(), dx, dy, d2;
+        __m128 half;
+        float total;
+        int i;
+
+        for (i = 0; i < global_balls.n; i += 8) {
+                dx = _mm256_sub_ps(px, _mm256_load_ps(global_balls.fx + i));
+                dy = _mm256_sub_ps(py, _mm256_load_ps(global_balls.fy + i));
+                d2 = _mm256_fmadd_ps(dx, dx, _mm256_mul_ps(dy, dy));
+                sum = _mm256_add_ps(sum, meta_rcp ? _mm256_rcp_ps(d2)
+                                    : _mm256_div_ps(_mm256_set1_ps(1.0f), d2));
+        }
+        half = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+        half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+        total = _mm_cvtss_f32(_mm_add_ss(half, _mm_shuffle_ps(half, half, 1)));
+
+        if (total > meta_lit_all)
+                return META_LIT;
+        if (total <= meta_dark_all)
+                return META_DARK;
+        return meta_pixel_exact(x, y);
+}
+
+/*
+ * The pixels' distances squared to each near ball come from one subtract
+ * and one FMA a lane. There's no early out once every lane is lit, as in
+ * the scalar kernel, most pixels are dark. Whole vectors of decided
+ * pixels are stored at once.
+ */
+__attribute__((target("avx2,fma")))
+static void meta_span_avx2(const struct meta_tile *tile,
+                           struct pixel *row, int32_t x0, int32_t x1,
+                           const double *xs, double y)
+{
+        const __m256 lit_limit = _mm256_set1_ps(tile->lit_limit);
+        const __m256 dark_limit = _mm256_set1_ps(tile->dark_limit);
+        const __m256d origin = _mm256_set1_pd(tile->origin_x);
+        const __m256i lit_pixels = _mm256_set1_epi32(pixel_bits(META_LIT));
+        const __m256i dark_pixels = _mm256_set1_epi32(pixel_bits(META_DARK));
+        const float *dy2 = tile->dy2;
+        float lanes[8];
+        __m256 px, sum, dx, d2, lit_lanes;
+        unsigned lit, dark;
+        int32_t x;
+        int i, n, lane;
+
+        meta_span_dy2(tile, y);
+
+        for (x = x0; x < x1; x += 8) {
+                n = x1 - x < 8 ? x1 - x : 8;
+                if (n == 8) {
+                        px = _mm256_set_m128(
+                                _mm256_cvtpd_ps(_mm256_sub_pd(_mm256_loadu_pd(xs + x + 4), origin)),
+                                _mm256_cvtpd_ps(_mm256_sub_pd(_mm256_loadu_pd(xs + x), origin)));
+                } else {
+                        for (lane = 0; lane < 8; lane++)
+                                lanes[lane] = xs[x + (lane < n ? lane : n - 1)] - tile->origin_x;
+                        px = _mm256_loadu_ps(lanes);
+                }
+
+                sum = _mm256_setzero_ps();
+                for (i = 0; i < tile->n_near; i++) {
+                        dx = _mm256_sub_ps(px, _mm256_broadcast_ss(&tile->near_x[i]));
+                        d2 = _mm256_fmadd_ps(dx, dx, _mm256_set1_ps(dy2[i]));
+                        sum = _mm256_add_ps(sum, meta_rcp ? _mm256_rcp_ps(d2)
+                                            : _mm256_div_ps(_mm256_set1_ps(1.0f), d2));
+                }
+
+                lit_lanes = _mm256_cmp_ps(sum, lit_limit, _CMP_GT_OQ);
+                lit = _mm256_movemask_ps(lit_lanes);
+                dark = _mm256_movemask_ps(_mm256_cmp_ps(sum, dark_limit, _CMP_LE_OQ));
+                if (n == 8 && (lit | dark) == 0xff) {
+                        __m256i pixels = _mm256_blendv_epi8(dark_pixels, lit_pixels,
+                                                            _mm256_castps_si256(lit_lanes));
+                        if ((uintptr_t)(row + x) % 32 == 0)
+                                _mm256_stream_si256((__m256i *)(row + x), pixels);
+                        else
+                                _mm256_storeu_si256((__m256i *)(row + x), pixels);
+                        continue;
+                }
+                meta_store_lanes(row, x, n, lit, dark, xs, y, meta_pixel_all_avx2);
+        }
+        _mm_sfence();
+}
+
+/* meta_pixel_all_avx2() 16 balls at a time. */
+__attribute__((target("avx512f")))
+static struct pixel meta_pixel_all_avx512(double x, double y)
+{
+        const __m512 px = _mm512_set1_ps(x), py = _mm512_set1_ps(y);
+        __m512 sum = _mm512_setzero_ps(), dx, dy, d2;
+        float total;
+        int i;
+
+        for (i = 0; i < global_balls.n; i += 16) {
+                dx = _mm512_sub_ps(px, _mm512_load_ps(global_balls.fx + i));
+                dy = _mm512_sub_ps(py, _mm512_load_ps(global_balls.fy + i));
+                d2 = _mm512_fmadd_ps(dx, dx, _mm512_mul_ps(dy, dy));
+                sum = _mm512_add_ps(sum, meta_rcp ? _mm512_rcp14_ps(d2)
+                                    : _mm512_div_ps(_mm512_set1_ps(1.0f), d2));
+        }
+        total = _mm512_reduce_add_ps(sum);
+
+        if (total > meta_lit_all)
+                return META_LIT;
+        if (total <= meta_dark_all)
+                return META_DARK;
+        return meta_pixel_exact(x, y);
+}
+
+__attribute__((target("avx512f")))
+static void meta_span_avx512(const struct meta_tile *tile,
+                             struct pixel *row, int32_t x0, int32_t x1,
+                             const double *xs, double y)
+{
+        const __m512 lit_limit = _mm512_set1_ps(tile->lit_limit);
+        const __m512 dark_limit = _mm512_set1_ps(tile->dark_limit);
+        const __m512d origin = _mm512_set1_pd(tile->origin_x);
+        const __m512i lit_pixels = _mm512_set1_epi32(pixel_bits(META_LIT));
+        const __m512i dark_pixels = _mm512_set1_epi32(pixel_bits(META_DARK));
+        const float *dy2 = tile->dy2;
+        __m512 px, sum, dx, d2;
+        __mmask8 lo, hi;
+        unsigned lit, dark;
+        int32_t x;
+        int i, n;
+
+        meta_span_dy2(tile, y);
+
+        for (x = x0; x < x1; x += 16) {
+                n = x1 - x < 16 ? x1 - x : 16;
+                lo = n >= 8 ? 0xff : (1u << n) - 1;
+                hi = n >= 16 ? 0xff : n > 8 ? (1u << (n - 8)) - 1 : 0;
+                px = _mm512_castpd_ps(_mm512_insertf64x4(
+                        _mm512_castps_pd(_mm512_castps256_ps512(_mm512_cvtpd_ps(
+                                _mm512_sub_pd(_mm512_maskz_loadu_pd(lo, xs + x), origin)))),
+                        _mm256_castps_pd(_mm512_cvtpd_ps(
+                                _mm512_sub_pd(_mm512_maskz_loadu_pd(hi, xs + x + 8), origin))),
+                        1));
+
+                sum = _mm512_setzero_ps();
+                for (i = 0; i < tile->n_near; i++) {
+                        dx = _mm512_sub_ps(px, _mm512_set1_ps(tile->near_x[i]));
+                        d2 = _mm512_fmadd_ps(dx, dx, _mm512_set1_ps(dy2[i]));
+                        sum = _mm512_add_ps(sum, meta_rcp ? _mm512_rcp14_ps(d2)
+                                            : _mm512_div_ps(_mm512_set1_ps(1.0f), d2));
+                }
+
+                lit = _mm512_cmp_ps_mask(sum, lit_limit, _CMP_GT_OQ);
+                dark = _mm512_cmp_ps_mask(sum, dark_limit, _CMP_LE_OQ);
+                if (n == 16 && (lit | dark) == 0xffff) {
+                        __m512i pixels = _mm512_mask_blend_epi32(lit, dark_pixels, lit_pixels);
+                        if ((uintptr_t)(row + x) % CACHE_LINE == 0)
+                                _mm512_stream_si512((__m512i *)(row + x), pixels);
+                        else
+                                _mm512_storeu_si512(row + x, pixels);
+                        continue;
+                }
+                meta_store_lanes(row, x, n, lit, dark, xs, y, meta_pixel_all_avx512);
+        }
+        _mm_sfence();
+}
+
+#endif /* META_X86 */
+
+static const struct meta_kernel {
+        const char *name;
+        meta_span_fn span;
+} meta_kernels[] = {
+#ifdef META_X86
+        { "avx512", meta_span_avx512 },
+        { "avx2",   meta_span_avx2 },
+#endif
+        { "scalar", meta_span_scalar },
+};
+
+enum { N_META_KERNELS = sizeof meta_kernels / sizeof meta_kernels[0] };
+
+static meta_span_fn meta_span = meta_span_scalar;
+
+static int meta_kernel_supported(const struct meta_kernel *kernel)
+{
+#ifdef META_X86
+        __builtin_cpu_init();
+        if (kernel->span == meta_span_avx512)
+                return __builtin_cpu_supports("avx512f");
+        if (kernel->span == meta_span_avx2)
+                return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+        return 1;
+}
+
+/*
+ * Pick the widest kernel the CPU supports. Setting $META_KERNEL to one of
+ * avx512, avx2 or scalar forces that kernel instead (if supported), and
+ * $META_RCP=0 has the vector kernels divide instead of using the
+ * approximate reciprocal.
+ */
+static void meta_select_kernel(void)
+{
+        const char *want = getenv("META_KERNEL");
+        const char *rcp = getenv("META_RCP");
+        int i;
+
+        for (i = 0; i < N_META_KERNELS; i++) {
+                if (want && strcmp(want, meta_kernels[i].name) != 0)
+                        continue;
+                if (meta_kernel_supported(&meta_kernels[i]))
+                        break;
+        }
+        if (i == N_META_KERNELS) {
+                fprintf(stderr, "Metaballs kernel '%s' not available\n", want);
+                i = N_META_KERNELS - 1;
+        }
+        meta_span = meta_kernels[i].span;
+        meta_rcp = !rcp || strcmp(rcp, "0") != 0;
+
+#ifdef META_X86
+        meta_lit_all = meta_threshold * (1 + META_MARGIN);
+        if (meta_lit_all < meta_threshold * (1 + META_MARGIN))
+                meta_lit_all = nextafterf(meta_lit_all, INFINITY);
+        meta_dark_all = meta_threshold / (1 + BOUND_SLACK) / (1 + META_MARGIN);
+        if (meta_dark_all > meta_threshold / (1 + BOUND_SLACK) / (1 + META_MARGIN))
+                meta_dark_all = nextafterf(meta_dark_all, -INFINITY);
+        if (meta_span != meta_span_scalar) {
+                fprintf(stderr, "Metaballs kernel: %s, %s\n", meta_kernels[i].name,
+                        meta_rcp ? "approximate reciprocal" : "division");
+                return;
+        }
+#endif
+        fprintf(stderr, "Metaballs kernel: %s\n", meta_kernels[i].name);
+}
+
+/* Paint row[x0..x1) at cartesian coordinates (xs[x], y) inside tile. */
+void meta_paint_span(const struct meta_tile *tile,
+                     struct pixel *row, int32_t x0, int32_t x1,
+                     const double *xs, double y)
+{
+        if (tile->vector)
+                meta_span(tile, row, x0, x1, xs, y);
+        else
+                meta_span_scalar(tile, row, x0, x1, xs, y);
+}
+
+static void meta_init(void)
+{
+        meta_alloc();
+        meta_select_kernel();
+}
+
+static int meta_scene_update(struct worker_pool *workers, int first, struct damage *damage,
+                             int32_t width, int32_t height, uint64_t budget_ns)
+{
+        double max_xx, max_yy;
+
+        viewport_extents(width, height, &max_xx, &max_yy);
+        meta_update(first, damage, width, height, max_xx, max_yy);
+        return 0;
+}
+
+/*
+ * Damaged spans of each row first, then walk the rows in tiles so the
+ * ball culling is done once per tile.
+ */
+static void meta_render_tile(const struct render_job *job, int32_t y0, int32_t y1)
+{
+        const struct canvas *canvas = job->canvas;
+        struct span spans[BAND_ROWS][MAX_DAMAGE_RECTS];
+        int n_spans[BAND_ROWS];
+        struct meta_tile *tile;
+        int32_t tx, tx_end, x0, x1;
+        int r, s, tile_ready;
+        double yy, y_top, y_bottom;
+
+        assert(y1 - y0 <= BAND_ROWS);
+        for (r = 0; y0 + r < y1; r++)
+                n_spans[r] = damage_row_spans(job->repaint, y0 + r,
+                                              canvas->width, spans[r]);
+        tile = thread_tile();
+
+        y_top = (2.0 * (double)y0 / (double)canvas->height - 1.0) * job->max_yy;
+        y_bottom = (2.0 * (double)(y1 - 1) / (double)canvas->height - 1.0) * job->max_yy;
+
+        for (tx = 0; tx < canvas->width; tx += META_TILE) {
+                tx_end = tx + META_TILE;
+                if (tx_end > canvas->width)
+                        tx_end = canvas->width;
+                tile_ready = 0;
+
+                for (r = 0; y0 + r < y1; r++) {
+                        /* Translated x,y pixel coords to cartesian cooridinates with 0,0 in middle */
+                        yy = 2.0 * (double)(y0 + r) / (double)canvas->height - 1.0;
+                        yy *= job->max_yy;
+
+                        for (s = 0; s < n_spans[r]; s++) {
+                                x0 = spans[r][s].x0 > tx ? spans[r][s].x0 : tx;
+                                x1 = spans[r][s].x1 < tx_end ? spans[r][s].x1 : tx_end;
+                                if (x0 >= x1)
+                                        continue;
+
+                                if (!tile_ready) {
+                                        meta_tile_init(tile,
+                                                       job->xs[tx], y_top,
+                                                       job->xs[tx_end - 1], y_bottom);
+                                        tile_ready = 1;
+                                }
+                                meta_paint_span(tile,
+                                                (struct pixel *)((char *)canvas->data
+                                                                 + (y0 + r) * canvas->stride),
+                                                x0, x1, job->xs, yy);
+                        }
+                }
+        }
+}
+
+static void meta_destroy(void)
+{
+        free(global_balls.x);
+        memset(&global_balls, 0, sizeof global_balls);
+        free(grid.start);
+        free(grid.next);
+        free(grid.index);
+        free(grid.cell);
+        free(grid.bounds);
+        memset(&grid, 0, sizeof grid);
+}
+
+const struct renderer meta_renderer = {
+        .name        = "meta",
+        .init        = meta_init,
+        .update      = meta_scene_update,
+        .render_tile = meta_render_tile,
+        .destroy     = meta_destroy,
+};
@@ -0,0 +1,145 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <wayland-client.h>
+#include "simple.h"
+
+/*
+ * Mandelbrot palettes.
+ *
+ * The kernels only count iterations, and colouring is one lookup per pixel
+ * into palette_lut, which holds the colour of every count from 0 to
+ * brot_max_iter. The table is rebuilt only when the palette, the phase or
+ * brot_max_iter change, so switching palettes or cycling one costs a pass
+ * over the count plane instead of iterating the set again.
+ *
+ * The plain palette is brot_colour() and doesn't cycle. The others repeat
+ * every PALETTE_PERIOD counts, blending between a few colour stops, and
+ * paint points inside the set opaque black.
+ */
+
+enum {
+        PALETTE_STOPS = 4,
+};
+
+struct palette {
+        const char *name;
+        uint32_t stops[PALETTE_STOPS];  /* 0xrrggbb, evenly spaced around the period */
+};
+
+static const struct palette palettes[N_PALETTES] = {
+        [PALETTE_PLAIN] = { "plain", { 0 } },
+        [PALETTE_FIRE]  = { "fire",  { 0x000000, 0xb01000, 0xffb000, 0xffffe0 } },
+        [PALETTE_OCEAN] = { "ocean", { 0x000764, 0x206bcb, 0xedffff, 0xffaa00 } },
+};
+
+struct pixel *palette_lut;
+int palette_id = PALETTE_PLAIN;
+int palette_cycle;
+int palette_phase;
+
+/* What palette_lut was last built for. */
+static struct {
+        int id, max_iter, phase;
+} built = { -1, 0, 0 };
+
+int palette_by_name(const char *name)
+{
+        int i;
+
+        for (i = 0; i < N_PALETTES; i++)
+                if (strcmp(name, palettes[i].name) == 0)
+                        return i;
+        return -1;
+}
+
+const char *palette_name(int id)
+{
+        return palettes[id].name;
+}
+
+/* Channel at shift of stop a, blended t/span of the way to stop b. */
+static uint8_t blend(uint32_t a, uint32_t b, int shift, int t, int span)
+{
+        int ca = (a >> shift) & 0xff;
+        int cb = (b >> shift) & 0xff;
+
+        return ca + (cb - ca) * t / span;
+}
+
+static void gradient(struct pixel *pixel, const struct palette *palette, int i)
+{
+        int span = PALETTE_PERIOD / PALETTE_STOPS;
+        int pos = i % PALETTE_PERIOD;
+        int s = pos / span, t = pos % span;
+        uint32_t a = palette->stops[s];
+        uint32_t b = palette->stops[(s + 1) % PALETTE_STOPS];
+
+        pixel->r = blend(a, b, 16, t, span);
+        pixel->g = blend(a, b, 8, t, span);
+        pixel->b = blend(a, b, 0, t, span);
+        pixel->a = 255;
+}
+
+/**
+ * Rebuild palette_lut if palette_id, palette_phase or brot_max_iter have
+ * changed since it was last built. Returns 1 if it was rebuilt, and every
+ * coloured pixel is out of date.
+ */
+int palette_update(void)
+{
+        const struct palette *palette = &palettes[palette_id];
+        int i, phase = palette_cycling() ? palette_phase : 0;
+
+        if (built.id == palette_id && built.max_iter == brot_max_iter
+            && built.phase == phase)
+                return 0;
+
+        if (built.max_iter != brot_max_iter) {
+                palette_lut = realloc(palette_lut, (brot_max_iter + 1) * sizeof *palette_lut);
+                assert(palette_lut != NULL);
+        }
+
+        for (i = 0; i <= brot_max_iter; i++) {
+                if (palette_id == PALETTE_PLAIN)
+                        brot_colour(&palette_lut[i], i);
+                else if (i == brot_max_iter)
+                        palette_lut[i] = (struct pixel){ 0, 0, 0, 255 };
+                else
+                        gradient(&palette_lut[i], palette, i + phase);
+        }
+
+        built.id = palette_id;
+        built.max_iter = brot_max_iter;
+        built.phase = phase;
+        return 1;
+}
+
+/**
+ * 1 if the palette changes from frame to frame.
+ */
+int palette_cycling(void)
+{
+        return palette_cycle != 0 && palette_id != PALETTE_PLAIN;
+}
+
+/**
+ * Move a cycling palette on by a frame.
+ */
+void palette_tick(void)
+{
+        if (!palette_cycling())
+                return;
+        palette_phase = (palette_phase + palette_cycle) % PALETTE_PERIOD;
+        if (palette_phase < 0)
+                palette_phase += PALETTE_PERIOD;
+}
+
+void palette_destroy(void)
+{
+        free(palette_lut);
+        palette_lut = NULL;
+        built.id = -1;
+        built.max_iter = 0;
+}
@@ -0,0 +1,63 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <wayland-client.h>
+#include "simple.h"
+
+/*
+ * Float and fixed point round differently from double, and near the
+ * boundary that changes a few counts. Where brot_precision() still picks
+ * float, at most MAX_BAD_PPM pixels per million may differ from double,
+ * as the README and brot_precision() promise.
+ */
+
+enum { WIDTH = 1280, HEIGHT = 720, N_VIEWS = 4, MAX_ITER = 64, MAX_BAD_PPM = 2000 };
+
+/* The default view, and views on the boundary at float's smallest pixel. */
+static const struct view views[N_VIEWS] = {
+        { .radius = 1 },
+        { .cx = -1.5532211851994038, .cy = 0.26921792335005634, .radius = 0x1p-12 * HEIGHT / 2 },
+        { .cx = -1.0125889163917785, .cy = 1.367983936178746, .radius = 0x1p-12 * HEIGHT / 2 },
+        { .cx = -3.0873780253841527, .cy = 0.0, .radius = 0x1p-12 * HEIGHT / 2 },
+};
+
+int main(void)
+{
+        static uint16_t counts[N_BROT_PRECISIONS][WIDTH];
+        static const char *const precisions[] = { "float", "fixed" };
+        double xs[WIDTH], pixel, x0, y0;
+        int failed = 0, v, p, x, y, bad[BROT_DOUBLE];
+
+        brot_max_iter = MAX_ITER;
+        brot_select_kernel();
+
+        for (v = 0; v < N_VIEWS; v++) {
+                if (brot_precision(&views[v], WIDTH, HEIGHT) != BROT_FLOAT) {
+                        printf("view %d: float isn't picked\n", v);
+                        failed = 1;
+                }
+
+                view_map(&views[v], WIDTH, HEIGHT, &pixel, &x0, &y0);
+                for (x = 0; x < WIDTH; x++)
+                        xs[x] = x * pixel + x0;
+                for (p = 0; p < BROT_DOUBLE; p++)
+                        bad[p] = 0;
+                for (y = 0; y < HEIGHT; y++) {
+                        for (p = 0; p <= BROT_DOUBLE; p++)
+                                brot_spans[p](counts[p], WIDTH, xs, y * pixel + y0);
+                        for (p = 0; p < BROT_DOUBLE; p++)
+                                for (x = 0; x < WIDTH; x++)
+                                        bad[p] += counts[p][x] != counts[BROT_DOUBLE][x];
+                }
+
+                for (p = 0; p < BROT_DOUBLE; p++) {
+                        if ((long)bad[p] * 1000000 <= (long)MAX_BAD_PPM * WIDTH * HEIGHT)
+                                continue;
+                        printf("view %d: %s counts differ from double in %d pixels\n",
+                               v, precisions[p], bad[p]);
+                        failed = 1;
+                }
+        }
+
+        return failed;
+}
@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <wayland-client.h>
+#include "simple.h"
+
+/*
+ * Presentation feedback.
+ *
+ * A frame callback only says it's a good time to draw, not when anything
+ * reached the screen. With wp_presentation every commit asks for feedback,
+ * which says when the frame was shown, on the compositor's presentation
+ * clock, or that it never was. That gives:
+ *
+ * - the latency from commit to screen, and how many refreshes went by
+ *   without the new frame that was due, printed with the fps,
+ * - the refresh period, straight from the compositor, in place of the
+ *   estimate from frame callback times (see frame_cadence()),
+ * - when the next refresh is, so a frame is given the time left until it
+ *   rather than half a refresh from whenever its callback happened to
+ *   come (see present_budget()).
+ */
+
+/* What a commit's feedback needs to be made sense of. */
+struct present_frame {
+        struct my_window *window;
+        uint64_t commit_ns;             /* On the presentation clock */
+};
+
+static uint64_t present_now(const struct my_display *display)
+{
+        struct timespec ts;
+
+        clock_gettime(display->presentation_clock, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static void feedback_sync_output(void *data,
+                                 struct wp_presentation_feedback *feedback,
+                                 struct wl_output *output)
+{
+}
+
+static void feedback_presented(void *data,
+                               struct wp_presentation_feedback *feedback,
+                               uint32_t tv_sec_hi, uint32_t tv_sec_lo,
+                               uint32_t tv_nsec, uint32_t refresh,
+                               uint32_t seq_hi, uint32_t seq_lo,
+                               uint32_t flags)
+{
+        struct present_frame *frame = data;
+        struct my_window *window = frame->window;
+        struct present_stats *stats = &window->present;
+        uint64_t present, latency, seq, refreshes = 0;
+
+        present = (((uint64_t)tv_sec_hi << 32) + tv_sec_lo) * 1000000000u + tv_nsec;
+        latency = present > frame->commit_ns ? present - frame->commit_ns : 0;
+        seq = ((uint64_t)seq_hi << 32) + seq_lo;
+
+        /* Refreshes since the last frame shown, by the output's counter
+         * if it has one, or else by the clock. */
+        if (seq && window->present_seq && seq > window->present_seq)
+                refreshes = seq - window->present_seq;
+        else if (refresh && window->present_ns && present > window->present_ns)
+                refreshes = (present - window->present_ns + refresh / 2) / refresh;
+
+        /* 0 if the output doesn't refresh at a fixed rate. */
+        if (refresh && refresh != window->present_refresh_ns) {
+                printf("Refresh period %.3f ms\n", refresh / 1e6);
+                window->present_refresh_ns = refresh;
+                window->refresh_ns = refresh;
+        }
+        /* A frame committed before the refresh after the last one shown
+         * was due at that refresh, and missed every one after it. One
+         * committed later followed an idle spell, and how long the
+         * compositor takes to show a frame is latency, not a miss. */
+        if (refreshes > 1 && window->present_refresh_ns
+            && frame->commit_ns < window->present_ns + window->present_refresh_ns)
+                stats->missed += refreshes - 1;
+        window->present_ns = present;
+        window->present_seq = seq;
+
+        stats->presented++;
+        stats->latency_ns += latency;
+        if (latency > stats->max_latency_ns)
+                stats->max_latency_ns = latency;
+        if (trace_enabled)
+                trace_interval(TRACE_PRESENT, frame->commit_ns, present);
+
+        wp_presentation_feedback_destroy(feedback);
+        free(frame);
+}
+
+static void feedback_discarded(void *data,
+                               struct wp_presentation_feedback *feedback)
+{
+        struct present_frame *frame = data;
+
+        frame->window->present.discarded++;
+        wp_presentation_feedback_destroy(feedback);
+        free(frame);
+}
+
+static const struct wp_presentation_feedback_listener feedback_listener = {
+        .sync_output = feedback_sync_output,
+        .presented   = feedback_presented,
+        .discarded   = feedback_discarded,
+};
+
+/**
+ * Ask to hear when the commit window is about to make reaches the screen.
+ */
+void present_feedback(struct my_window *window)
+{
+        struct my_display *display = window->display;
+        struct wp_presentation_feedback *feedback;
+        struct present_frame *frame;
+
+        if (!display->presentation)
+                return;
+
+        frame = malloc(sizeof *frame);
+        if (frame == NULL) {
+                perror(""); exit(1);
+        }
+        frame->window = window;
+        frame->commit_ns = present_now(display);
+
+        feedback = wp_presentation_feedback(display->presentation, window->surface);
+        wp_presentation_feedback_add_listener(feedback, &feedback_listener, frame);
+}
+
+/**
+ * How long a frame started now may take to render (see scene_update()),
+ * leaving half a refresh for the compositor before the refresh it's for.
+ * That's the next one there's time for, or the one after if the frame is
+ * rendered ahead, behind one already committed for the next.
+ *
+ * Without presentation feedback, half the refresh interval, as if the
+ * frame callback came at a refresh.
+ */
+uint64_t present_budget(const struct my_window *window, int ahead)
+{
+        uint64_t refresh = window->present_refresh_ns;
+        uint64_t now, next, deadline;
+
+        if (!refresh || !window->present_ns)
+                return window->refresh_ns / 2;
+
+        /* Refreshes keep time with the last one seen. */
+        now = present_now(window->display);
+        next = window->present_ns + refresh;
+        if (now >= next)
+                next += (now - next) / refresh * refresh + refresh;
+
+        deadline = next - refresh / 2;
+        if (deadline < now + refresh / 4)
+                deadline += refresh;
+        if (ahead)
+                deadline += refresh;
+        return deadline - now;
+}
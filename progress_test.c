@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <wayland-client.h>
+#include "simple.h"
+
+/*
+ * brot_progress() refined a budget at a time must end up with the counts
+ * of a single full render, from scratch and after every way the view can
+ * move: a pan of the finished image, a pan while still refining, a zoom
+ * in and a zoom out. When a move shows pixels the old view didn't, they
+ * must all get a coarse count within one first pass worth of budgets, not
+ * stay 0 until the last pass reaches them.
+ */
+
+enum { WIDTH = 203, HEIGHT = 117, MAX_ITER = 200 };
+
+static uint16_t want[HEIGHT][WIDTH];
+
+/* Counts of key's view rendered in one go. */
+static void render(const struct frame_key *key)
+{
+        double xs[WIDTH], pixel, x0, y0;
+        brot_span_fn span;
+        int32_t x, y;
+
+        view_map(&key->view, WIDTH, HEIGHT, &pixel, &x0, &y0);
+        span = brot_spans[brot_precision(&key->view, WIDTH, HEIGHT)];
+        for (x = 0; x < WIDTH; x++)
+                xs[x] = (double)(x + key->view.pan_x) * pixel + x0;
+        for (y = 0; y < HEIGHT; y++)
+                span(want[y], WIDTH, xs, (double)(y + key->view.pan_y) * pixel + y0);
+}
+
+/* Pixels brot_progress() has no count for yet. */
+static int unfilled(void)
+{
+        int32_t x, y;
+        int n = 0;
+
+        for (y = 0; y < HEIGHT; y++)
+                for (x = 0; x < WIDTH; x++)
+                        n += brot_progress_row(y)[x] == 0;
+        return n;
+}
+
+/* Refine key by a row, with the smallest budget. Returns 1 once done. */
+static int step(struct worker_pool *workers, const struct frame_key *key, int restart)
+{
+        struct damage damage;
+
+        damage_reset(&damage);
+        return brot_progress(workers, key, restart, 1, &damage);
+}
+
+/*
+ * Refine key a row at a time until it's done, checking that no pixel is
+ * left without a count after coarse calls (unless 0), and that the
+ * result is a full render's. Returns 1 if all is well.
+ */
+static int refine(struct worker_pool *workers, const struct frame_key *key,
+                  int restart, int coarse, const char *what)
+{
+        int32_t y;
+        int call, ok = 1;
+
+        for (call = 1; !step(workers, key, restart && call == 1); call++) {
+                if (call == coarse && unfilled()) {
+                        printf("%s: %d pixels still 0 after %d calls\n",
+                               what, unfilled(), coarse);
+                        ok = 0;
+                }
+        }
+
+        render(key);
+        for (y = 0; y < HEIGHT; y++) {
+                if (memcmp(brot_progress_row(y), want[y], sizeof want[y]) != 0) {
+                        printf("%s: row %d differs from a full render\n", what, y);
+                        return 0;
+                }
+        }
+        return ok;
+}
+
+int main(void)
+{
+        struct worker_pool *workers;
+        struct frame_key key = {
+                .width = WIDTH, .height = HEIGHT,
+                .view = { .cx = -1.55, .cy = 0.27, .radius = 0.05 },
+                .max_iter = MAX_ITER,
+        };
+        /* Calls of a row each that the first pass takes. */
+        int coarse = (HEIGHT + PROGRESS_STEP - 1) / PROGRESS_STEP;
+        int failed = 0;
+
+        brot_max_iter = MAX_ITER;
+        brot_select_kernel();
+        workers = worker_pool_create(1);
+
+        failed |= !refine(workers, &key, 1, coarse, "start");
+
+        key.view.pan_x += 37;
+        key.view.pan_y -= 11;
+        failed |= !refine(workers, &key, 0, 1, "pan");
+        key.view.pan_x -= 50;
+        key.view.pan_y += 20;
+        failed |= !refine(workers, &key, 0, 1, "pan back");
+
+        /* Zoom, refine a row of it, and pan before it's done. */
+        key.view.radius = 0.5;
+        step(workers, &key, 0);
+        key.view.pan_x -= 20;
+        key.view.pan_y += 9;
+        failed |= !refine(workers, &key, 0, coarse, "pan while refining");
+
+        key.view.radius /= 2.5;
+        failed |= !refine(workers, &key, 0, 0, "zoom in");
+
+        key.view.radius *= 3;
+        failed |= !refine(workers, &key, 0, coarse, "zoom out");
+
+        brot_renderer.destroy();
+        worker_pool_destroy(workers);
+        return failed;
+}
@@ -0,0 +1,497 @@
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <wayland-client.h>
+#include "simple.h"
+
+/*
+ * Progressive mandelbrot.
+ *
+ * A big window can't be iterated in one refresh interval, so the set is
+ * refined over several frames instead. Pass 0 iterates one pixel in every
+ * PROGRESS_STEP x PROGRESS_STEP block and fills the block with it, each
+ * later pass halves the step and iterates only the pixels the passes
+ * before it haven't, until the last pass (step 1) completes the image.
+ * Every pixel is iterated once with brot_span(), so the finished image is
+ * the same as a full render.
+ *
+ * Work is handed to the render threads a few sample rows at a time until
+ * the frame's time budget is used up; the rows painted become the frame's
+ * damage. The image is kept as iteration counts and brot_renderer's
+ * render_tile() colours the damage out of it, which is cheap next to
+ * iterating, and lets a new palette be shown without iterating anything.
+ *
+ * When the view moves, what's already been computed is reused. A pan of a
+ * finished image shifts it and iterates only the strips scrolled into
+ * view. Anything else resamples the old image into the new view as a
+ * placeholder and refines from the first pass that is no blockier than
+ * the placeholder, or from pass 0 if the view shows anything new.
+ *
+ * Each view is iterated in the precision brot_precision() picks for it.
+ * Deep views (see deep.c) keep their coordinates relative to the view's
+ * centre.
+ */
+
+/* Everything the render threads need to paint sample rows of a pass. */
+struct progress_job {
+        int32_t width, height;
+        int32_t step;                   /* Pixels between samples */
+        int first;                      /* Pass doesn't follow an earlier one */
+        int32_t row;                    /* Sample row of task 0 */
+};
+
+/* The same for the strips exposed by a pan of dx, dy. */
+struct pan_job {
+        int32_t width, height;
+        int32_t dx, dy;
+};
+
+/* And for resampling the old image into a new view. */
+struct resample_job {
+        int32_t width, height;
+        const int32_t *map_x, *map_y;   /* Old pixel of each new column/row, -1 if none */
+        int32_t old_width;
+        const uint16_t *old;
+};
+
+static struct {
+        struct frame_key key;           /* What image is being refined */
+        uint16_t *image;                /* Iteration counts, width * height, no padding */
+        uint16_t *scratch;              /* The previous image while resampling */
+        size_t image_len;
+        double pixel, x0, y0;           /* view_map() of key, relative to the centre if deep */
+        int deep;                       /* Iterated relative to brot_orbit */
+        brot_span_fn span;              /* Kernel for the view's precision */
+        double *xs;                     /* xx of every column */
+        double *xs_all, *xs_odd;        /* xx of every / every other sample of the pass */
+        int32_t xs_len;
+        int32_t *map_x, *map_y;         /* Resampling maps */
+        int32_t map_w, map_h;
+        int first_pass;                 /* Pass the refinement started at */
+        int pass;                       /* PROGRESS_PASSES once converged */
+        int32_t row;                    /* Next sample row of the pass */
+        double ns_per_row;              /* Recent cost of a sample row */
+} progress;
+
+static int32_t pass_step(int pass)
+{
+        return PROGRESS_STEP >> pass;
+}
+
+static int32_t pass_rows(int pass, int32_t height)
+{
+        return (height + pass_step(pass) - 1) / pass_step(pass);
+}
+
+/* Plane y of image row y. */
+static double row_yy(int32_t y)
+{
+        return (double)(y + progress.key.view.pan_y) * progress.pixel + progress.y0;
+}
+
+/* Sample coordinates of pass, every step'th column and the odd ones of those. */
+static void pass_xs(int pass, int32_t width)
+{
+        int32_t step = pass_step(pass), k;
+
+        for (k = 0; k * step < width; k++) {
+                progress.xs_all[k] = progress.xs[k * step];
+                if (k & 1)
+                        progress.xs_odd[k / 2] = progress.xs[k * step];
+        }
+}
+
+/*
+ * Iterate sample row job->row + task of the pass and fill its blocks.
+ * Runs on the render threads.
+ */
+static void progress_row(void *data, int task)
+{
+        const struct progress_job *job = data;
+        int32_t i = job->row + task;
+        int32_t step = job->step;
+        int32_t y = i * step, y_end, x, x_end, yb, k;
+        int32_t n_all = (job->width + step - 1) / step;
+        /* Rows the pass before didn't sample are new everywhere, the
+         * others only in the columns it skipped. */
+        int all = job->first || (i & 1);
+        int32_t n = all ? n_all : n_all / 2;
+        uint16_t samples[n > 0 ? n : 1];
+
+        if (n == 0)
+                return;
+
+        progress.span(samples, n, all ? progress.xs_all : progress.xs_odd, row_yy(y));
+
+        y_end = y + step < job->height ? y + step : job->height;
+        for (yb = y; yb < y_end; yb++) {
+                uint16_t *row = &progress.image[(size_t)yb * job->width];
+
+                for (k = 0; k < n; k++) {
+                        x = (all ? k : 2 * k + 1) * step;
+                        x_end = x + step < job->width ? x + step : job->width;
+                        for (; x < x_end; x++)
+                                row[x] = samples[k];
+                }
+        }
+}
+
+/* Make room for a width x height image and its coordinates. */
+static void progress_alloc(int32_t width, int32_t height)
+{
+        size_t len = (size_t)width * height;
+
+        if (progress.image_len < len) {
+                free(progress.image);
+                free(progress.scratch);
+                progress.image = malloc(len * sizeof *progress.image);
+                progress.scratch = malloc(len * sizeof *progress.scratch);
+                assert(progress.image && progress.scratch);
+                progress.image_len = len;
+        }
+        if (progress.xs_len < width) {
+                progress.xs = realloc(progress.xs, width * sizeof *progress.xs);
+                progress.xs_all = realloc(progress.xs_all, width * sizeof *progress.xs_all);
+                progress.xs_odd = realloc(progress.xs_odd, width * sizeof *progress.xs_odd);
+                assert(progress.xs && progress.xs_all && progress.xs_odd);
+                progress.xs_len = width;
+        }
+}
+
+/* Take on key's view and work out the coordinates of its columns. */
+static void progress_view(const struct frame_key *key)
+{
+        enum brot_precision precision;
+        int32_t x;
+
+        progress.key = *key;
+        view_map(&key->view, key->width, key->height,
+                 &progress.pixel, &progress.x0, &progress.y0);
+        precision = brot_precision(&key->view, key->width, key->height);
+        progress.span = brot_spans[precision];
+        progress.deep = precision == BROT_DEEP;
+        if (progress.deep) {
+                progress.x0 = -(double)key->width / 2.0 * progress.pixel;
+                progress.y0 = -(double)key->height / 2.0 * progress.pixel;
+                deep_reference(&key->view);
+        }
+        for (x = 0; x < key->width; x++)
+                progress.xs[x] = (double)(x + key->view.pan_x) * progress.pixel + progress.x0;
+}
+
+/* Refine the image from first_pass on. */
+static void progress_start(int first_pass)
+{
+        progress.first_pass = first_pass;
+        progress.pass = first_pass;
+        progress.row = 0;
+        pass_xs(first_pass, progress.key.width);
+}
+
+/*
+ * Iterate the part of row task the pan left uncovered.
+ * Runs on the render threads.
+ */
+static void pan_row(void *data, int task)
+{
+        const struct pan_job *job = data;
+        uint16_t *row = &progress.image[(size_t)task * job->width];
+        int32_t x0, x1;
+
+        if (task + job->dy < 0 || task + job->dy >= job->height) {
+                x0 = 0;
+                x1 = job->width;
+        } else if (job->dx > 0) {
+                x0 = job->width - job->dx;
+                x1 = job->width;
+        } else {
+                x0 = 0;
+                x1 = -job->dx;
+        }
+        if (x0 < x1)
+                progress.span(&row[x0], x1 - x0, &progress.xs[x0], row_yy(task));
+}
+
+/*
+ * The finished image moved by whole pixels: shift what's still in view
+ * and iterate only what scrolled in.
+ */
+static void progress_pan(struct worker_pool *workers, const struct frame_key *key)
+{
+        struct pan_job job;
+        int32_t y, y_end, step, x_src, x_dst, n;
+
+        job.width = key->width;
+        job.height = key->height;
+        job.dx = key->view.pan_x - progress.key.view.pan_x;
+        job.dy = key->view.pan_y - progress.key.view.pan_y;
+
+        /* Pixel y, x of the new image is y + dy, x + dx of the old one. */
+        x_src = job.dx > 0 ? job.dx : 0;
+        x_dst = job.dx > 0 ? 0 : -job.dx;
+        n = job.width - abs(job.dx);
+        y = job.dy > 0 ? 0 : job.height - 1;
+        y_end = job.dy > 0 ? job.height : -1;
+        step = job.dy > 0 ? 1 : -1;
+        for (; y != y_end; y += step) {
+                if (y + job.dy < 0 || y + job.dy >= job.height)
+                        continue;
+                memmove(&progress.image[(size_t)y * job.width + x_dst],
+                        &progress.image[(size_t)(y + job.dy) * job.width + x_src],
+                        n * sizeof *progress.image);
+        }
+
+        progress_view(key);
+        worker_pool_run(workers, job.height, pan_row, &job);
+}
+
+/*
+ * Fill row task of the new image with the nearest pixels of the old one.
+ * Runs on the render threads.
+ */
+static void resample_row(void *data, int task)
+{
+        const struct resample_job *job = data;
+        uint16_t *row = &progress.image[(size_t)task * job->width];
+        const uint16_t *old;
+        int32_t x;
+
+        if (job->map_y[task] < 0) {
+                memset(row, 0, job->width * sizeof *row);
+                return;
+        }
+        old = &job->old[(size_t)job->map_y[task] * job->old_width];
+        for (x = 0; x < job->width; x++) {
+                if (job->map_x[x] < 0)
+                        row[x] = 0;
+                else
+                        row[x] = old[job->map_x[x]];
+        }
+}
+
+/* Old pixel nearest to plane coordinate v, or -1 if it's out of view. */
+static int32_t old_index(double v, double x0, double pixel, int32_t pan, int32_t n)
+{
+        double i = floor((v - x0) / pixel - pan + 0.5);
+
+        return i >= 0 && i < n ? (int32_t)i : -1;
+}
+
+/*
+ * Stretch the old image over the new view, and return the first pass
+ * whose blocks are no bigger than a pixel of it. If the new view shows
+ * anything the old one didn't, that's pass 0, so all of it gets a coarse
+ * first look rather than waiting for the last pass.
+ */
+static int progress_resample(struct worker_pool *workers, const struct frame_key *key)
+{
+        struct resample_job job;
+        struct frame_key old = progress.key;
+        double old_pixel = progress.pixel, old_x0 = progress.x0, old_y0 = progress.y0;
+        int old_deep = progress.deep;
+        double scale, shift_x, shift_y;
+        uint16_t *swap;
+        int32_t i;
+        int pass, exposed = 0;
+
+        if (progress.map_w < key->width) {
+                progress.map_x = realloc(progress.map_x, key->width * sizeof *progress.map_x);
+                assert(progress.map_x != NULL);
+                progress.map_w = key->width;
+        }
+        if (progress.map_h < key->height) {
+                progress.map_y = realloc(progress.map_y, key->height * sizeof *progress.map_y);
+                assert(progress.map_y != NULL);
+                progress.map_h = key->height;
+        }
+
+        progress_view(key);
+
+        /* Measure the old coordinates from where the new ones are. */
+        deep_origin_shift(&old.view, old_deep, &key->view, progress.deep,
+                          &shift_x, &shift_y);
+        old_x0 += shift_x;
+        old_y0 += shift_y;
+
+        for (i = 0; i < key->width; i++) {
+                progress.map_x[i] = old_index(progress.xs[i], old_x0, old_pixel,
+                                              old.view.pan_x, old.width);
+                exposed |= progress.map_x[i] < 0;
+        }
+        for (i = 0; i < key->height; i++) {
+                progress.map_y[i] = old_index(row_yy(i), old_y0, old_pixel,
+                                              old.view.pan_y, old.height);
+                exposed |= progress.map_y[i] < 0;
+        }
+
+        swap = progress.image;
+        progress.image = progress.scratch;
+        progress.scratch = swap;
+
+        job.width = key->width;
+        job.height = key->height;
+        job.map_x = progress.map_x;
+        job.map_y = progress.map_y;
+        job.old_width = old.width;
+        job.old = progress.scratch;
+        worker_pool_run(workers, key->height, resample_row, &job);
+
+        if (exposed)
+                return 0;
+        scale = old_pixel / progress.pixel;
+        for (pass = 0; pass + 1 < PROGRESS_PASSES && pass_step(pass) > scale; pass++)
+                ;
+        return pass;
+}
+
+/**
+ * Refine the mandelbrot set described by key for up to budget_ns (0 for
+ * no limit), starting over if key changed or restart is set. Rows painted
+ * are added to damage. Returns 1 once the image is complete.
+ */
+int brot_progress(struct worker_pool *workers, const struct frame_key *key,
+                  int restart, uint64_t budget_ns, struct damage *damage)
+{
+        struct progress_job job;
+        uint64_t start, now, spent;
+        int32_t rows, chunk, y0, y1;
+
+        if (restart
+            || key->width != progress.key.width
+            || key->height != progress.key.height
+            || key->max_iter != progress.key.max_iter) {
+                progress_alloc(key->width, key->height);
+                progress_view(key);
+                progress_start(0);
+        } else if (!view_equal(&progress.key.view, &key->view)) {
+                /* Moved, the whole image changes. */
+                damage_all(damage);
+                if (progress.pass == PROGRESS_PASSES
+                    && key->view.cx == progress.key.view.cx
+                    && key->view.cy == progress.key.view.cy
+                    && key->view.cx_lo == progress.key.view.cx_lo
+                    && key->view.cy_lo == progress.key.view.cy_lo
+                    && key->view.radius == progress.key.view.radius
+                    && abs(key->view.pan_x - progress.key.view.pan_x) < key->width
+                    && abs(key->view.pan_y - progress.key.view.pan_y) < key->height)
+                        progress_pan(workers, key);
+                else
+                        progress_start(progress_resample(workers, key));
+        }
+
+        job.width = key->width;
+        job.height = key->height;
+
+        start = trace_now();
+        spent = 0;
+        while (progress.pass < PROGRESS_PASSES) {
+                rows = pass_rows(progress.pass, key->height);
+
+                /* As many rows as should fit in what's left of the
+                 * budget, but at least one per thread. */
+                chunk = rows - progress.row;
+                if (budget_ns && progress.ns_per_row > 0
+                    && (budget_ns - spent) / progress.ns_per_row < chunk)
+                        chunk = (budget_ns - spent) / progress.ns_per_row;
+                if (chunk < worker_pool_size(workers))
+                        chunk = worker_pool_size(workers);
+                if (chunk > rows - progress.row)
+                        chunk = rows - progress.row;
+
+                job.first = progress.pass == progress.first_pass;
+                job.step = pass_step(progress.pass);
+                job.row = progress.row;
+                worker_pool_run(workers, chunk, progress_row, &job);
+
+                y0 = job.row * job.step;
+                y1 = (job.row + chunk) * job.step;
+                if (y1 > key->height)
+                        y1 = key->height;
+                damage_add(damage, (struct rect){ 0, y0, key->width, y1 - y0 });
+
+                now = trace_now();
+                progress.ns_per_row = (double)(now - start - spent) / chunk;
+                spent = now - start;
+
+                progress.row += chunk;
+                if (progress.row >= rows) {
+                        progress.row = 0;
+                        if (++progress.pass < PROGRESS_PASSES)
+                                pass_xs(progress.pass, key->width);
+                }
+                if (budget_ns && spent >= budget_ns)
+                        break;
+        }
+
+        return progress.pass == PROGRESS_PASSES;
+}
+
+/**
+ * Row y of the image brot_progress() is refining.
+ */
+const uint16_t *brot_progress_row(int32_t y)
+{
+        return &progress.image[(size_t)y * progress.key.width];
+}
+
+static void brot_init(void)
+{
+        brot_select_kernel();
+}
+
+static int brot_update(struct worker_pool *workers, int first, struct damage *damage,
+                       int32_t width, int32_t height, uint64_t budget_ns)
+{
+        struct frame_key key;
+
+        /* A new palette only needs the counts coloured again. */
+        if (palette_update())
+                damage_all(damage);
+        scene_key(width, height, &key);
+        return brot_progress(workers, &key, first, budget_ns, damage)
+                && !palette_cycling();
+}
+
+/* brot_update() has iterated the set, colour what's damaged. */
+static void brot_render_tile(const struct render_job *job, int32_t y0, int32_t y1)
+{
+        const struct canvas *canvas = job->canvas;
+        struct span spans[MAX_DAMAGE_RECTS];
+        const uint16_t *src;
+        struct pixel *dst;
+        int n_spans, s;
+
+        for (; y0 < y1; y0++) {
+                n_spans = damage_row_spans(job->repaint, y0, canvas->width, spans);
+                src = brot_progress_row(y0);
+                dst = (struct pixel *)((char *)canvas->data + y0 * canvas->stride);
+                for (s = 0; s < n_spans; s++)
+                        brot_colour_span(&dst[spans[s].x0], &src[spans[s].x0],
+                                         spans[s].x1 - spans[s].x0);
+        }
+}
+
+static void brot_destroy(void)
+{
+        free(progress.image);
+        free(progress.scratch);
+        free(progress.xs);
+        free(progress.xs_all);
+        free(progress.xs_odd);
+        free(progress.map_x);
+        free(progress.map_y);
+        memset(&progress, 0, sizeof progress);
+        palette_destroy();
+        deep_destroy();
+}
+
+const struct renderer brot_renderer = {
+        .name        = "brot",
+        .init        = brot_init,
+        .update      = brot_update,
+        .render_tile = brot_render_tile,
+        .destroy     = brot_destroy,
+        .still       = 1,
+};
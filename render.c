@@ -0,0 +1,216 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <wayland-client.h>
+#include "simple.h"
+
+/*
+ * Pixel generation, independent of wayland.
+ *
+ * draw() and the headless mode both come through here: scene_update()
+ * moves the demo on one frame and reports what changed, render_frame()
+ * paints the requested part of a canvas on the render threads. Both hand
+ * over to the current renderer, once per frame and once per tile.
+ */
+
+static const struct renderer *const renderers[] = {
+        &brot_renderer,
+        &meta_renderer,
+};
+
+const struct renderer *renderer = &brot_renderer;
+
+/* The mandelbrot viewport, moved around by input. */
+struct view brot_view = { 0.0, 0.0, 0.0, 0.0, 1.0, 0, 0 };
+
+/* The render thread holds this for the whole of a frame, input takes it
+ * to move the view or change the palette in between. */
+pthread_mutex_t scene_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Half extents of the visible plane. The shorter side spans [-1, 1],
+ * the longer one keeps pixels square.
+ */
+void viewport_extents(int32_t width, int32_t height,
+                      double *max_xx, double *max_yy)
+{
+        if (width > height) {
+                *max_yy = 1.0;
+                *max_xx = (double)width / (double)height;
+        } else {
+                *max_xx = 1.0;
+                *max_yy = (double)height / (double)width;
+        }
+}
+
+/**
+ * The renderer called name, or NULL if there is none.
+ */
+const struct renderer *renderer_by_name(const char *name)
+{
+        int i;
+
+        for (i = 0; i < sizeof renderers / sizeof renderers[0]; i++)
+                if (strcmp(name, renderers[i]->name) == 0)
+                        return renderers[i];
+        return NULL;
+}
+
+/**
+ * Back to the whole set, with the shorter side spanning [-1, 1].
+ */
+void view_reset(struct view *view)
+{
+        view->cx = 0.0;
+        view->cy = 0.0;
+        view->cx_lo = 0.0;
+        view->cy_lo = 0.0;
+        view->radius = 1.0;
+        view->pan_x = 0;
+        view->pan_y = 0;
+}
+
+/**
+ * The size of a pixel and the coordinates of pixel (0, 0) before panning,
+ * when view is shown in a width x height window.
+ */
+void view_map(const struct view *view, int32_t width, int32_t height,
+              double *pixel, double *x0, double *y0)
+{
+        *pixel = 2.0 * view->radius / (double)(width < height ? width : height);
+        *x0 = view->cx - (double)width / 2.0 * *pixel;
+        *y0 = view->cy - (double)height / 2.0 * *pixel;
+}
+
+/**
+ * Move the view by dx, dy pixels.
+ */
+void view_pan(struct view *view, int32_t dx, int32_t dy)
+{
+        view->pan_x += dx;
+        view->pan_y += dy;
+}
+
+/**
+ * Magnify the view by factor, keeping the point under pixel px, py of a
+ * width x height window where it is. Won't zoom in past DEEP_MIN_RADIUS.
+ */
+void view_zoom(struct view *view, int32_t width, int32_t height,
+               double factor, double px, double py)
+{
+        double pixel, x0, y0, at_x, at_y;
+
+        if (view->radius / factor < DEEP_MIN_RADIUS)
+                return;
+
+        /* The point under the pointer, relative to the centre. */
+        view_map(view, width, height, &pixel, &x0, &y0);
+        at_x = (px + view->pan_x - (double)width / 2.0) * pixel;
+        at_y = (py + view->pan_y - (double)height / 2.0) * pixel;
+
+        view->radius /= factor;
+        pixel /= factor;
+        deep_move(view, at_x + ((double)width / 2.0 - px) * pixel,
+                  at_y + ((double)height / 2.0 - py) * pixel);
+        view->pan_x = 0;
+        view->pan_y = 0;
+}
+
+/**
+ * What a finished frame of width x height looks like.
+ */
+void scene_key(int32_t width, int32_t height, struct frame_key *key)
+{
+        *key = (struct frame_key){ .width = width, .height = height };
+
+        /* The rest only changes what the mandelbrot set looks like. */
+        if (renderer != &brot_renderer)
+                return;
+        key->view = brot_view;
+        key->max_iter = brot_max_iter;
+        key->palette = palette_id;
+        key->phase = palette_phase;
+}
+
+int view_equal(const struct view *a, const struct view *b)
+{
+        return a->cx == b->cx
+                && a->cy == b->cy
+                && a->cx_lo == b->cx_lo
+                && a->cy_lo == b->cy_lo
+                && a->radius == b->radius
+                && a->pan_x == b->pan_x
+                && a->pan_y == b->pan_y;
+}
+
+int frame_key_equal(const struct frame_key *a, const struct frame_key *b)
+{
+        return a->width == b->width
+                && a->height == b->height
+                && view_equal(&a->view, &b->view)
+                && a->max_iter == b->max_iter
+                && a->palette == b->palette
+                && a->phase == b->phase;
+}
+
+/**
+ * Advance the demo by one frame, or set it up if first is set, spending
+ * about budget_ns on it (0 for as long as it takes). Pixels that change
+ * are added to damage. Returns 1 once the scene won't change any more.
+ */
+int scene_update(struct worker_pool *workers, int first, struct damage *damage,
+                 int32_t width, int32_t height, uint64_t budget_ns)
+{
+        return renderer->update(workers, first, damage, width, height, budget_ns);
+}
+
+/*
+ * Paint rows [band * BAND_ROWS, (band + 1) * BAND_ROWS) of the frame.
+ * Runs on the render threads.
+ */
+static void render_band(void *data, int band)
+{
+        const struct render_job *job = data;
+        int32_t y, y_end;
+
+        y = band * BAND_ROWS;
+        y_end = y + BAND_ROWS;
+        if (y_end > job->canvas->height)
+                y_end = job->canvas->height;
+
+        renderer->render_tile(job, y, y_end);
+}
+
+/**
+ * Paint the repaint region of canvas with the current scene.
+ */
+void render_frame(struct worker_pool *workers,
+                  const struct canvas *canvas,
+                  const struct damage *repaint)
+{
+        struct render_job job;
+        int32_t x;
+
+        /* Column coordinates, shared by every row of the frame. */
+        static double *xs;
+        static int32_t xs_len;
+
+        viewport_extents(canvas->width, canvas->height, &job.max_xx, &job.max_yy);
+
+        if (xs_len < canvas->width) {
+                xs = realloc(xs, canvas->width * sizeof *xs);
+                assert(xs != NULL);
+                xs_len = canvas->width;
+        }
+        for (x = 0; x < canvas->width; x++)
+                xs[x] = (2.0 * (double)x / (double)canvas->width - 1.0) * job.max_xx;
+
+        job.canvas = canvas;
+        job.xs = xs;
+        job.repaint = repaint;
+
+        worker_pool_run(workers,
+                        (canvas->height + BAND_ROWS - 1) / BAND_ROWS,
+                        render_band, &job);
+}
@@ -0,0 +1,113 @@
+#include <math.h>
+#include <stdio.h>
+
+#include <wayland-client.h>
+#include "simple.h"
+
+/*
+ * Dynamic resolution.
+ *
+ * A window that takes longer than a refresh interval to render drops
+ * frames, and everything it does feels slow. With wp_viewporter it
+ * renders into smaller buffers instead, and the compositor scales them up
+ * to the window: the picture gets softer, but keeps up. Nothing but the
+ * size of the canvas changes for the renderers.
+ *
+ * The render scale is in SCALE_ONE'ths of the window's width and height.
+ * Render times are smoothed over a few frames. Over the refresh interval,
+ * the scale drops in one go to what should take SCALE_TARGET of it (cost
+ * goes with area, so with the square of the scale). While rendering a
+ * step bigger would still take under SCALE_HEADROOM of it, the scale
+ * rises by a step. Every change is held for SCALE_HOLD frames so the new
+ * size is measured before the next.
+ */
+
+/* Fractions of the refresh interval to aim for going down and up. */
+static const double SCALE_TARGET = 0.75;
+static const double SCALE_HEADROOM = 0.5;
+
+int scale_min = SCALE_ONE / 4;
+
+/**
+ * The size window renders its next frame at.
+ */
+void scale_size(const struct my_window *window, int32_t *width, int32_t *height)
+{
+        *width = (window->width * window->scale + SCALE_ONE - 1) / SCALE_ONE;
+        *height = (window->height * window->scale + SCALE_ONE - 1) / SCALE_ONE;
+        if (*width < 1)
+                *width = 1;
+        if (*height < 1)
+                *height = 1;
+}
+
+/**
+ * Account for a frame of window that took render_ns to render, and pick
+ * the scale of the frames after it.
+ */
+void scale_update(struct my_window *window, uint64_t render_ns)
+{
+        double budget = window->refresh_ns;
+        double step;
+        int32_t width, height;
+        int scale = window->scale;
+
+        if (!window->viewport)
+                return;
+
+        window->render_ns = window->render_ns
+                ? (3 * window->render_ns + render_ns) / 4 : render_ns;
+        if (window->scale_hold > 0) {
+                window->scale_hold--;
+                return;
+        }
+
+        if (window->render_ns > budget) {
+                scale = scale * sqrt(SCALE_TARGET * budget / window->render_ns);
+                if (scale >= window->scale)
+                        scale = window->scale - 1;
+        } else if (scale < SCALE_ONE) {
+                step = (double)(scale + 1) / scale;
+                if (window->render_ns * step * step < SCALE_HEADROOM * budget)
+                        scale++;
+        }
+        if (scale < scale_min)
+                scale = scale_min;
+        if (scale > SCALE_ONE)
+                scale = SCALE_ONE;
+        if (scale == window->scale)
+                return;
+
+        /* Pans are in pixels, which are about to change size. Move the
+         * centre to where the pan has got to instead. */
+        scale_size(window, &width, &height);
+        view_zoom(&brot_view, width, height, 1.0, 0, 0);
+
+        printf("Render scale %d/%d\n", scale, SCALE_ONE);
+        window->scale = scale;
+        window->scale_hold = SCALE_HOLD;
+        window->render_ns = 0;
+}
+
+/**
+ * Have the compositor show buffer, about to be committed, at the size of
+ * window.
+ */
+void scale_viewport(struct my_window *window, const struct my_buffer *buffer)
+{
+        int32_t width = -1, height = -1;
+
+        if (!window->viewport)
+                return;
+
+        if (buffer->width != window->width || buffer->height != window->height) {
+                width = window->width;
+                height = window->height;
+        }
+        if (width == window->dest_width && height == window->dest_height)
+                return;
+
+        wp_viewport_set_destination(window->viewport, width, height);
+        window->dest_width = width;
+        window->dest_height = height;
+}
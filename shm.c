@@ -0,0 +1,197 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <wayland-client.h>
+#include "simple.h"
+
+/*
+ * Shared memory for wl_shm pools.
+ *
+ * Prefer an anonymous memfd, which never touches a filesystem and can be
+ * sealed against shrinking so the compositor can trust its mapping. Fall
+ * back to POSIX shm, then to a file in $XDG_RUNTIME_DIR (a tmpfs on any
+ * sane system). Named objects are unlinked as soon as they're open.
+ */
+
+/* Use MFD_HUGETLB for pools of at least HUGE_PAGE bytes. */
+int shm_hugetlb;
+
+static int memfd_shm(int hugetlb)
+{
+#ifdef MFD_CLOEXEC
+        unsigned flags = MFD_CLOEXEC | MFD_ALLOW_SEALING;
+
+#ifdef MFD_HUGETLB
+        if (hugetlb)
+                flags |= MFD_HUGETLB;
+#endif
+        return memfd_create("simple-shm", flags);
+#else
+        errno = ENOSYS;
+        return -1;
+#endif
+}
+
+static int posix_shm(void)
+{
+        static unsigned counter;
+        char name[64];
+        int fd;
+
+        snprintf(name, sizeof name, "/simple-shm-%d-%u", (int)getpid(), counter++);
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+        if (fd >= 0)
+                shm_unlink(name);
+        return fd;
+}
+
+static int runtime_dir_shm(void)
+{
+        const char *dir = getenv("XDG_RUNTIME_DIR");
+        char *path;
+        int fd;
+
+        if (!dir) {
+                errno = ENOENT;
+                return -1;
+        }
+
+        if (asprintf(&path, "%s/simple-shm-XXXXXX", dir) < 0)
+                return -1;
+        fd = mkostemp(path, O_CLOEXEC);
+        if (fd >= 0)
+                unlink(path);
+        free(path);
+        return fd;
+}
+
+static size_t round_size(const struct shm *shm, size_t size)
+{
+        if (shm->hugetlb)
+                size = (size + HUGE_PAGE - 1) & ~(size_t)(HUGE_PAGE - 1);
+        return size;
+}
+
+static void advise(const struct shm *shm)
+{
+#ifdef MADV_HUGEPAGE
+        /* Let the kernel back big pools with transparent huge pages, if
+         * shmem THP is enabled, to cut TLB misses on full screen writes. */
+        if (!shm->hugetlb && shm->size >= HUGE_PAGE)
+                madvise(shm->data, shm->size, MADV_HUGEPAGE);
+#endif
+}
+
+/**
+ * Create a shared memory object of at least size bytes and map it.
+ * shm->size may be rounded up (to a whole huge page). shm->fd stays open
+ * so the object can be grown later.
+ */
+void shm_create(struct shm *shm, size_t size)
+{
+        int sealed = 1;
+
+        shm->hugetlb = shm_hugetlb && size >= HUGE_PAGE;
+        shm->size = round_size(shm, size);
+
+        shm->fd = memfd_shm(shm->hugetlb);
+        if (shm->fd < 0 && shm->hugetlb) {
+                shm->hugetlb = 0;
+                shm->size = size;
+                shm->fd = memfd_shm(0);
+        }
+        if (shm->fd < 0) {
+                sealed = 0;
+                shm->fd = posix_shm();
+        }
+        if (shm->fd < 0)
+                shm->fd = runtime_dir_shm();
+        if (shm->fd < 0) {
+                perror("Failed making shm");
+                exit(1);
+        }
+
+        if (ftruncate(shm->fd, shm->size) < 0) {
+                close(shm->fd);
+                perror("Failed to resize shm");
+                exit(1);
+        }
+
+        shm->data = mmap(NULL, shm->size, PROT_READ | PROT_WRITE, MAP_SHARED, shm->fd, 0);
+        if (shm->data == MAP_FAILED && shm->hugetlb) {
+                /* No huge pages reserved, try again with normal ones. */
+                close(shm->fd);
+                shm_hugetlb = 0;
+                shm_create(shm, size);
+                return;
+        }
+        if (shm->data == MAP_FAILED) {
+                close(shm->fd);
+                perror("Mmap failed");
+                exit(1);
+        }
+
+#ifdef F_SEAL_SHRINK
+        if (sealed && fcntl(shm->fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_SEAL) < 0)
+                perror("Failed to seal shm");
+#endif
+        advise(shm);
+
+        fprintf(stderr, "Made shm { size: %zu, %s%s }\n", shm->size,
+                sealed ? "memfd" : "named",
+                shm->hugetlb ? ", hugetlb" : "");
+}
+
+/**
+ * Grow shm to at least size bytes. The mapping may move, so shm->data
+ * must be reloaded by the caller.
+ */
+void shm_grow(struct shm *shm, size_t size)
+{
+        void *data;
+
+        size = round_size(shm, size);
+        if (size <= shm->size)
+                return;
+
+        if (ftruncate(shm->fd, size) < 0) {
+                perror("Failed to grow shm");
+                exit(1);
+        }
+
+        data = mremap(shm->data, shm->size, size, MREMAP_MAYMOVE);
+        if (data == MAP_FAILED && errno == EINVAL && shm->hugetlb) {
+                /* Kernels before 6.3 can't mremap hugetlb, so map the
+                 * grown object afresh. It's shared, nothing is lost. */
+                data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, shm->fd, 0);
+                if (data != MAP_FAILED)
+                        munmap(shm->data, shm->size);
+        }
+        if (data == MAP_FAILED) {
+                perror("Mremap failed");
+                exit(1);
+        }
+
+        fprintf(stderr, "Grew shm { size: %zu -> %zu }\n", shm->size, size);
+        shm->data = data;
+        shm->size = size;
+        advise(shm);
+}
+
+void shm_destroy(struct shm *shm)
+{
+        if (shm->data)
+                munmap(shm->data, shm->size);
+        if (shm->fd >= 0)
+                close(shm->fd);
+        shm->data = NULL;
+        shm->size = 0;
+        shm->fd = -1;
+}
@@ -1,32 +1,202 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <math.h>
 #include <string.h>
 #include <time.h>
 #include <assert.h>
 
-#include <signal.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <getopt.h>
 
 #include <wayland-client.h>
 #include "simple.h"
 
-/* Marks the end of program running. */
-static int running = 1;
-static void signal_int(int signum) {
-        running = 0;
+static void usage(const char *name)
+{
+        fprintf(stderr,
+                "Usage: %s [options]\n"
+                "  --headless WxH   Render offscreen at W by H pixels, no compositor needed\n"
+                "  --frames N       Frames to render in headless mode (default 100)\n"
+                "  --threads N      Render threads in headless mode (default one per CPU)\n"
+                "  --dump FILE      Save the last headless frame, as PPM if FILE ends\n"
+                "                   in .ppm, raw ARGB8888 rows otherwise\n"
+                "  --buffers N      Buffers to allocate at most when the compositor holds\n"
+                "                   on to them, 2 to 4 (default 3)\n"
+                "  --renderer NAME  Demo to show: brot for the mandelbrot set (default)\n"
+                "                   or meta for metaballs\n"
+                "  --balls N        Metaballs to show, smaller the more there are,\n"
+                "                   up to %d (default %d)\n"
+                "  --max-iter N     Mandelbrot iterations before a point counts as\n"
+                "                   inside the set, up to %d (default %d)\n"
+                "  --view X,Y,R     Start the mandelbrot view centred on X + iY with radius R,\n"
+                "                   to about 30 digits for deep zooms\n"
+                "  --palette NAME   Mandelbrot colours: plain, fire or ocean (default plain)\n"
+                "  --cycle N        Rotate the palette by N entries a frame, %d to %d\n"
+                "  --render-ahead   Render each frame before its frame callback, so the\n"
+                "                   callback only has to commit it\n"
+                "  --min-scale F    Render down to F of the window's width and height when\n"
+                "                   frames run late, if the compositor can scale them up\n"
+                "                   (default 0.25, 1 to always render at full size)\n"
+                "  --hugetlb        Back large shm pools with explicit huge pages\n"
+                "  --trace          Record frame timings, printed on SIGUSR1 and at exit\n"
+                "  --bench FILE     Time every kernel, writing JSON lines to FILE\n"
+                "                   (- for stdout), --frames renders each (default 10)\n",
+                name, META_MAX_BALLS, META_BALLS, BROT_ITER_LIMIT, BROT_MAX_ITER,
+                1 - PALETTE_PERIOD, PALETTE_PERIOD - 1);
 }
 
-int main(void)
+int main(int argc, char **argv)
 {
-        struct sigaction   sigint;
         struct my_display *display;
         struct my_window  *window;
 
+        static const struct option long_options[] = {
+                { "headless", required_argument, NULL, 'H' },
+                { "frames",   required_argument, NULL, 'n' },
+                { "threads",  required_argument, NULL, 't' },
+                { "dump",     required_argument, NULL, 'o' },
+                { "bench",    required_argument, NULL, 'b' },
+                { "trace",    no_argument,       NULL, 'T' },
+                { "buffers",  required_argument, NULL, 'B' },
+                { "renderer", required_argument, NULL, 'r' },
+                { "balls",    required_argument, NULL, 'N' },
+                { "max-iter", required_argument, NULL, 'I' },
+                { "view",     required_argument, NULL, 'v' },
+                { "palette",  required_argument, NULL, 'p' },
+                { "cycle",    required_argument, NULL, 'c' },
+                { "render-ahead", no_argument,   NULL, 'A' },
+                { "min-scale", required_argument, NULL, 'S' },
+                { "hugetlb",  no_argument,       NULL, 'P' },
+                { "help",     no_argument,       NULL, 'h' },
+                { NULL, 0, NULL, 0 }
+        };
+        struct headless_options headless = { 0, 0, 0, 0, NULL };
+        int headless_mode = 0;
+        const char *bench = NULL;
+        char *end;
+        long cycle;
+        int buffers = DEFAULT_BUFFERS;
+        int render_ahead = 0;
+        int opt, status;
+
+        while ((opt = getopt_long(argc, argv, "H:n:t:o:b:B:r:N:I:v:p:c:AS:TPh", long_options, NULL)) != -1) {
+                switch (opt) {
+                case 'H':
+                        if (sscanf(optarg, "%dx%d", &headless.width, &headless.height) != 2
+                            || headless.width <= 0 || headless.height <= 0) {
+                                fprintf(stderr, "Bad size '%s', expected WxH\n", optarg);
+                                return 1;
+                        }
+                        headless_mode = 1;
+                        break;
+                case 'n':
+                        headless.frames = atoi(optarg);
+                        break;
+                case 't':
+                        headless.threads = atoi(optarg);
+                        break;
+                case 'o':
+                        headless.dump = optarg;
+                        break;
+                case 'b':
+                        bench = optarg;
+                        break;
+                case 'T':
+                        trace_enabled = 1;
+                        break;
+                case 'B':
+                        buffers = atoi(optarg);
+                        if (buffers < MIN_BUFFERS || buffers > MAX_BUFFERS) {
+                                fprintf(stderr, "Bad buffer count '%s', expected %d to %d\n",
+                                        optarg, MIN_BUFFERS, MAX_BUFFERS);
+                                return 1;
+                        }
+                        break;
+                case 'r':
+                        renderer = renderer_by_name(optarg);
+                        if (!renderer) {
+                                fprintf(stderr, "Unknown renderer '%s'\n", optarg);
+                                return 1;
+                        }
+                        break;
+                case 'N':
+                        meta_balls = atoi(optarg);
+                        if (meta_balls <= 0 || meta_balls > META_MAX_BALLS) {
+                                fprintf(stderr, "Bad ball count '%s'\n", optarg);
+                                return 1;
+                        }
+                        break;
+                case 'I':
+                        brot_max_iter = atoi(optarg);
+                        if (brot_max_iter <= 0 || brot_max_iter > BROT_ITER_LIMIT) {
+                                fprintf(stderr, "Bad iteration count '%s'\n", optarg);
+                                return 1;
+                        }
+                        break;
+                case 'v':
+                        if (!deep_parse_view(&brot_view, optarg)) {
+                                fprintf(stderr, "Bad view '%s', expected X,Y,R\n", optarg);
+                                return 1;
+                        }
+                        break;
+                case 'p':
+                        palette_id = palette_by_name(optarg);
+                        if (palette_id < 0) {
+                                fprintf(stderr, "Unknown palette '%s'\n", optarg);
+                                return 1;
+                        }
+                        break;
+                case 'c':
+                        cycle = strtol(optarg, &end, 10);
+                        if (end == optarg || *end
+                            || cycle <= -PALETTE_PERIOD || cycle >= PALETTE_PERIOD) {
+                                fprintf(stderr, "Bad cycle '%s', expected %d to %d\n",
+                                        optarg, 1 - PALETTE_PERIOD, PALETTE_PERIOD - 1);
+                                return 1;
+                        }
+                        palette_cycle = cycle;
+                        break;
+                case 'A':
+                        render_ahead = 1;
+                        break;
+                case 'S':
+                        scale_min = (int)ceil(atof(optarg) * SCALE_ONE);
+                        if (scale_min < 1 || scale_min > SCALE_ONE) {
+                                fprintf(stderr, "Bad scale '%s', expected a scale in (0, 1]\n", optarg);
+                                return 1;
+                        }
+                        break;
+                case 'P':
+                        shm_hugetlb = 1;
+                        break;
+                default:
+                        usage(argv[0]);
+                        return opt == 'h' ? 0 : 1;
+                }
+        }
+
+        if (bench)
+                return bench_run(bench, headless.frames ? headless.frames : 10);
+
+        renderer->init();
+
+        if (headless_mode) {
+                if (!headless.frames)
+                        headless.frames = 100;
+                status = headless_run(&headless);
+                renderer->destroy();
+                return status;
+        }
+
+        /* Signals are read in the main loop, not by whichever thread
+         * they happen to land on. */
+        loop_block_signals();
+
         /* Connect to the display */
         printf("Connecting to display\n");
         display = create_display();
@@ -37,14 +207,10 @@ int main(void)
         window = create_window(display, MIN_WIDTH, MIN_HEIGHT);
         if (!window)
                 return 1;
+        window->max_buffers = buffers;
+        window->render_ahead = render_ahead;
         printf("Window created\n");
 
-        /* Set up singal handler. So SIGINT allows us to cleanly die. */
-        sigint.sa_handler = signal_int;
-        sigemptyset(&sigint.sa_mask);
-        sigint.sa_flags = SA_RESETHAND;
-        sigaction(SIGINT, &sigint, NULL);
-
         printf("Initialising buffers\n");
         /* Initialize */
         wl_surface_damage(window->surface, 0, 0, window->width, window->height);
@@ -52,20 +218,20 @@ int main(void)
         draw(window, NULL, 0);
        
         printf("Starting loop\n");
-        /* Main loop */
-        while (running) {
-                if (wl_display_dispatch(display->display) == -1) {
-                        running = 0;
-                }
-        }
+        /* Main loop, until SIGINT or SIGTERM */
+        status = loop_run(display, window) < 0;
         printf("Loop exited\n");
+
+        if (trace_enabled)
+                trace_dump(stdout);
         
         /* Destroy the display */
         printf("Destroying window\n");
         destroy_window(window); window = NULL;
         printf("Disconnecting display\n");
         destroy_display(display); display = NULL;
+        renderer->destroy();
         printf("Done\n");
 
-        return 0;
+        return status;
 }
@@ -1,13 +1,33 @@
 #ifndef SIMPLE_H_
 #define SIMPLE_H_
 
+#include <stdio.h>
+#include <pthread.h>
+#include <time.h>
 #include <wayland-client.h>
 #include "xdg-shell-client-protocol.h"
+#include "viewporter-client-protocol.h"
+#include "presentation-time-client-protocol.h"
 
 enum {
         MIN_WIDTH   = 640,            /**< Max width of window in pixels */
         MIN_HEIGHT  = 480,            /**< Max height of window in pixels */
-        BUFFERS = 2,                  /**< Number of frame buffers. */
+        MIN_BUFFERS = 2,              /**< Frame buffers a window can get by with. */
+        MAX_BUFFERS = 4,              /**< Most frame buffers a window will allocate. */
+        DEFAULT_BUFFERS = 3,          /**< Buffers allowed unless --buffers says otherwise. */
+        CACHE_LINE = 64,              /**< Bytes per cache line. */
+        BAND_ROWS = 8,                /**< Rows per render task. */
+        MAX_DAMAGE_RECTS = MAX_BUFFERS * 32, /**< Rects per damage, MAX_BUFFERS frames of metaballs. */
+        DAMAGE_HISTORY = 4,           /**< Frames of damage kept for buffer ages. */
+        HUGE_PAGE = 2 << 20,          /**< Bytes per huge page. */
+        REFRESH_NS = 16666667,        /**< Refresh interval to assume until frame callbacks tell. */
+        SCALE_ONE = 16,               /**< Render scale of a full resolution window. */
+        SCALE_HOLD = 8,               /**< Frames to measure a new render scale before changing it. */
+};
+
+/* RGBA32 pixel */
+struct pixel {
+        uint8_t b, g, r, a;
 };
 
 /**
@@ -25,18 +45,105 @@ struct my_display {
         struct wl_shm        *shm;
         struct xdg_shell     *xdg_shell;
         struct wl_shell      *shell;
+        struct wp_viewporter *viewporter;     /* NULL if the compositor can't scale */
+        struct wp_presentation *presentation; /* NULL if there's no presentation feedback */
+        clockid_t presentation_clock;         /* What presentation timestamps are on */
         struct wl_output     *output;
+        struct wl_seat       *seat;
+        struct wl_pointer    *pointer;
+        struct wl_keyboard   *keyboard;
+        struct my_window     *window;        /* Where input goes */
         int formats;
 
         // Output size in pixels.
         int32_t width, height;
 };
 
+struct rect {
+        int32_t x, y, width, height;
+};
+
+/* Half open range [x0, x1) of a row. */
+struct span {
+        int32_t x0, x1;
+};
+
+struct damage {
+        int full;                             /* Everything, rects are ignored */
+        int n_rects;
+        struct rect rects[MAX_DAMAGE_RECTS];
+};
+
+/* Pixels to render into, stride is in bytes. */
+struct canvas {
+        struct pixel *data;
+        int32_t width, height, stride;
+};
+
+/*
+ * Where the mandelbrot set is looked at from. Pixel x of a window maps to
+ * (x + pan_x) * pixel + x0, see view_map(), so panning by whole pixels
+ * leaves the coordinates of the pixels still in view exactly the same.
+ */
+struct view {
+        double cx, cy;                        /* Centre, before panning */
+        double cx_lo, cy_lo;                  /* Low halves of the centre, for deep zooms */
+        double radius;                        /* Half extent of the shorter side */
+        int32_t pan_x, pan_y;                 /* Pixels panned from the centre */
+};
+
+/* Everything that decides what a rendered frame looks like. */
+struct frame_key {
+        int32_t width, height;
+        struct view view;
+        int max_iter;
+        int palette, phase;
+};
+
+/* A mapped shared memory object. */
+struct shm {
+        int fd;
+        void *data;
+        size_t size;
+        int hugetlb;
+};
+
+/* Timestamps of the stages of one frame in ns, 0 if not reached. */
+struct frame_trace {
+        uint64_t callback, acquire, render_start, render_end, commit;
+};
+
 struct my_buffer {
+        struct my_window *window;
         struct wl_buffer *buffer;
         int32_t width, height, stride;        /* The width and height on last render */
         void *data;
+        size_t offset, capacity;              /* Slot of the shm pool holding data */
         int busy;
+        unsigned released;                    /* Release order, larger is more recent */
+        struct frame_key key;                 /* What data currently holds */
+        int complete;                         /* data is finished, not still being refined */
+        int age;                              /* Frames since data was on screen, 0 if undefined */
+        uint64_t commit_ns;                   /* When last committed, for tracing */
+};
+
+/* Presentation feedback, added up between fps reports. */
+struct present_stats {
+        unsigned presented, discarded;
+        unsigned missed;                      /* Refreshes a due frame wasn't ready for */
+        uint64_t latency_ns, max_latency_ns;  /* Commit to presentation */
+};
+
+/* A frame handed to the render thread, see render_start(). */
+struct frame_job {
+        struct my_buffer *buffer;             /* Where it goes, reserved (busy) meanwhile */
+        struct frame_key key;                 /* What it shows */
+        int first;                            /* The window's first frame */
+        uint64_t budget_ns;                   /* Time scene_update() may take */
+        int render;                           /* buffer didn't already hold key */
+        int done;                             /* The scene is finished, see scene_update() */
+        uint64_t render_ns;                   /* Time the render thread spent on it */
+        struct frame_trace trace;
 };
 
 struct my_window {
@@ -48,9 +155,43 @@ struct my_window {
         struct wl_shell_surface *shell_surface;
         struct xdg_surface *xdg_surface;
         struct wl_shm_pool *shm_pool;
-        char *shm_fname;
-        void *shm_data;
-        struct my_buffer buffers[BUFFERS];
+        struct shm shm;                       /* Memory behind shm_pool */
+        size_t shm_used;                      /* Bytes of shm handed out to buffers */
+        struct my_buffer buffers[MAX_BUFFERS];
+        int n_buffers;                        /* Buffers allocated so far */
+        int max_buffers;                      /* Most buffers to allocate, at most MAX_BUFFERS */
+        int stalled;                          /* A frame was skipped for want of a buffer */
+        unsigned stalls;                      /* Frames skipped so far */
+        int render_ahead;                     /* Render the next frame before its callback */
+        struct my_buffer *ready;              /* Rendered ahead, waiting for the callback */
+        int ready_dropped;                    /* ready went stale, its damage is still owed */
+        struct frame_trace ready_trace;       /* Stages of ready reached so far */
+        uint32_t callback_ms;                 /* Time of the last frame callback */
+        uint64_t refresh_ns;                  /* Estimated interval between frame callbacks */
+        struct my_buffer *front;              /* Last buffer committed */
+        struct wl_buffer *retired;            /* front's old wl_buffer, shown until the next commit */
+        unsigned frame;                       /* Frames committed so far */
+        struct damage damage[DAMAGE_HISTORY]; /* Damage of recent frames, by frame % DAMAGE_HISTORY */
+        struct worker_pool *workers;
+        struct wp_viewport *viewport;         /* Scales buffers up to the window, or NULL */
+        int scale;                            /* Render size in SCALE_ONE'ths of the window's */
+        int scale_hold;                       /* Frames until the scale may change again */
+        uint64_t render_ns;                   /* Smoothed time to render a frame */
+        int32_t dest_width, dest_height;      /* Viewport destination, -1 if unset */
+        pthread_t render_thread;              /* Renders frames off the main thread */
+        pthread_mutex_t render_lock;          /* Guards job_posted and render_quit */
+        pthread_cond_t render_cond;           /* Signalled when a job is posted or to quit */
+        int job_posted;                       /* job is waiting for the render thread */
+        int render_quit;
+        int render_fd;                        /* eventfd, readable once a job is done */
+        int rendering;                        /* job is out on the render thread */
+        struct frame_job job;
+        int commit_wanted;                    /* Commit job as soon as it's done */
+        uint64_t callback_ns;                 /* When the frame being drawn was asked for */
+        uint64_t present_ns;                  /* When a frame last reached the screen, 0 if unknown */
+        uint64_t present_refresh_ns;          /* Refresh period the compositor reports, 0 if unknown */
+        uint64_t present_seq;                 /* Refresh counter of present_ns, 0 if unknown */
+        struct present_stats present;
 };
 
 /* Display */
@@ -61,7 +202,285 @@ void destroy_display(struct my_display *display);
 struct my_window *create_window(struct my_display *display, int width, int height);
 void              destroy_window(struct my_window *window);
 
+/* Shared memory */
+extern int shm_hugetlb;
+
+void shm_create(struct shm *shm, size_t size);
+void shm_grow(struct shm *shm, size_t size);
+void shm_destroy(struct shm *shm);
+
+/* Input */
+void input_bind(struct my_display *display, struct wl_registry *registry,
+                uint32_t name, uint32_t version);
+void input_destroy(struct my_display *display);
+
+/* Presentation feedback */
+void     present_feedback(struct my_window *window);
+uint64_t present_budget(const struct my_window *window, int ahead);
+
+/* Dynamic resolution */
+extern int scale_min;                   /* Lowest render scale, SCALE_ONE to never scale */
+
+void scale_size(const struct my_window *window, int32_t *width, int32_t *height);
+void scale_update(struct my_window *window, uint64_t render_ns);
+void scale_viewport(struct my_window *window, const struct my_buffer *buffer);
+
 /* Buffers */
 void draw(void *window, struct wl_callback *callback, uint32_t serial);
+void redraw(struct my_window *window);
+struct my_buffer *select_buffer(struct my_window *window, int32_t width, int32_t height);
+void render_ahead(struct my_window *window);
+void render_thread_start(struct my_window *window);
+void render_thread_stop(struct my_window *window);
+void render_finish(struct my_window *window);
+
+/* Main loop */
+void loop_block_signals(void);
+int  loop_run(struct my_display *display, struct my_window *window);
+
+/* Rendering */
+
+/* Everything a render thread needs to paint a tile of the frame. */
+struct render_job {
+        const struct canvas *canvas;
+        double max_xx, max_yy;
+        const double *xs;               /* xx for every column of the frame */
+        const struct damage *repaint;   /* Pixels that need painting */
+};
+
+/*
+ * A demo. update() moves it on by a frame, see scene_update(), and
+ * render_tile() paints the damaged part of rows [y0, y1) of the canvas on
+ * a render thread, so dispatch is per tile and each demo's inner loop is
+ * its own.
+ */
+struct renderer {
+        const char *name;
+        void (*init)(void);
+        int  (*update)(struct worker_pool *workers, int first, struct damage *damage,
+                       int32_t width, int32_t height, uint64_t budget_ns);
+        void (*render_tile)(const struct render_job *job, int32_t y0, int32_t y1);
+        void (*destroy)(void);
+        int still;                      /* Only input changes it, after the first frame */
+};
+
+extern const struct renderer brot_renderer;
+extern const struct renderer meta_renderer;
+extern const struct renderer *renderer;  /* The one shown, brot_renderer unless --renderer */
+extern struct view brot_view;
+
+const struct renderer *renderer_by_name(const char *name);
+
+void viewport_extents(int32_t width, int32_t height,
+                      double *max_xx, double *max_yy);
+void view_reset(struct view *view);
+void view_map(const struct view *view, int32_t width, int32_t height,
+              double *pixel, double *x0, double *y0);
+void view_pan(struct view *view, int32_t dx, int32_t dy);
+void view_zoom(struct view *view, int32_t width, int32_t height,
+               double factor, double px, double py);
+void scene_key(int32_t width, int32_t height, struct frame_key *key);
+int  view_equal(const struct view *a, const struct view *b);
+int  frame_key_equal(const struct frame_key *a, const struct frame_key *b);
+extern pthread_mutex_t scene_lock;      /* Held while the scene is read or changed */
+
+int  scene_update(struct worker_pool *workers, int first, struct damage *damage,
+                  int32_t width, int32_t height, uint64_t budget_ns);
+void render_frame(struct worker_pool *workers,
+                  const struct canvas *canvas,
+                  const struct damage *repaint);
+
+/* Headless */
+struct headless_options {
+        int32_t width, height;
+        int frames;
+        int threads;                          /* 0 for one per CPU */
+        const char *dump;                     /* .ppm or raw ARGB file, or NULL */
+};
+
+int headless_run(const struct headless_options *options);
+
+/* Benchmarks */
+int bench_run(const char *path, int frames);
+
+/* Frame timing */
+enum trace_hist {
+        TRACE_FRAME_INTERVAL,
+        TRACE_WAIT_BUFFER,
+        TRACE_RENDER,
+        TRACE_SUBMIT,
+        TRACE_FRAME,
+        TRACE_HELD,
+        TRACE_PRESENT,
+        N_TRACE_HISTS
+};
+
+extern int trace_enabled;
+
+/* Current time if tracing, otherwise 0 without touching the clock. */
+#define TRACE_NOW() (trace_enabled ? trace_now() : 0)
+
+uint64_t trace_now(void);
+void     trace_interval(enum trace_hist hist, uint64_t start, uint64_t end);
+void     trace_frame(const struct frame_trace *trace);
+void     trace_dump(FILE *out);
+
+/* Damage */
+void damage_reset(struct damage *damage);
+void damage_all(struct damage *damage);
+void damage_add(struct damage *damage, struct rect rect);
+void damage_merge(struct damage *dst, const struct damage *src);
+int  damage_row_spans(const struct damage *damage,
+                      int32_t y, int32_t width,
+                      struct span *spans);
+void damage_surface(struct wl_surface *surface,
+                    const struct damage *damage,
+                    int32_t width, int32_t height);
+
+/* Mandelbrot */
+enum {
+        BROT_MAX_ITER = 50,             /* Default for brot_max_iter */
+        BROT_ITER_LIMIT = UINT16_MAX,   /* Counts are stored as uint16_t */
+};
+
+extern int brot_max_iter;               /* Iterations before a point counts as inside */
+
+/* Count iterations for n points of a row at cartesian coordinates (xs[i], y). */
+typedef void (*brot_span_fn)(uint16_t *counts, int32_t n,
+                             const double *xs, double y);
+/* Colour n iteration counts through palette_lut. */
+typedef void (*brot_colour_fn)(struct pixel *row, const uint16_t *counts, int32_t n);
+
+/* What the set is iterated in, fastest first. */
+enum brot_precision {
+        BROT_FLOAT,
+        BROT_FIXED,                     /* int32_t, Q7.24 */
+        BROT_DOUBLE,
+        BROT_DEEP,                      /* xs, y relative to brot_orbit's centre */
+        N_BROT_PRECISIONS,
+};
+
+extern brot_span_fn brot_spans[N_BROT_PRECISIONS];
+extern brot_colour_fn brot_colour_span;
+
+void brot_colour(struct pixel *pixel, int i);
+void paint_brot_pixel(struct pixel *pixel, double x, double y);
+void brot_select_kernel(void);
+enum brot_precision brot_precision(const struct view *view,
+                                   int32_t width, int32_t height);
+
+/* Deep zoom */
+#define DEEP_PIXEL 0x1p-42              /* Smallest pixel plain doubles render */
+#define DEEP_MIN_RADIUS 1e-26           /* Smallest radius double-doubles render */
+
+/* The reference orbit deep views are iterated relative to. */
+struct brot_orbit {
+        double *x, *y;                  /* Plane coordinates of z, 0 to len */
+        int len;                        /* Escaped or hit brot_max_iter at len */
+};
+
+extern struct brot_orbit brot_orbit;
+
+int  deep_view(const struct view *view, int32_t width, int32_t height);
+void deep_reference(const struct view *view);
+void deep_move(struct view *view, double dx, double dy);
+void deep_origin_shift(const struct view *a, int a_deep,
+                       const struct view *b, int b_deep,
+                       double *dx, double *dy);
+int  deep_parse_view(struct view *view, const char *s);
+void deep_destroy(void);
+
+/* Palettes */
+enum palette_id {
+        PALETTE_PLAIN,
+        PALETTE_FIRE,
+        PALETTE_OCEAN,
+        N_PALETTES,
+};
+
+enum {
+        PALETTE_PERIOD = 64,          /**< Counts before a gradient repeats. */
+};
+
+extern struct pixel *palette_lut;       /* Colour of each count, 0 to brot_max_iter */
+extern int palette_id;
+extern int palette_cycle;               /* Entries to rotate per frame, 0 for still */
+extern int palette_phase;
+
+int palette_by_name(const char *name);
+const char *palette_name(int id);
+int palette_update(void);
+void palette_tick(void);
+int palette_cycling(void);
+void palette_destroy(void);
+
+/* Progressive mandelbrot */
+enum {
+        PROGRESS_STEP = 8,            /**< Pixels between samples of the first pass. */
+        PROGRESS_PASSES = 4,          /**< Passes to go from PROGRESS_STEP to 1. */
+};
+
+int brot_progress(struct worker_pool *workers, const struct frame_key *key,
+                  int restart, uint64_t budget_ns, struct damage *damage);
+const uint16_t *brot_progress_row(int32_t y);
+
+/* Metaballs */
+enum {
+        META_BALLS = 30,              /**< Metaballs unless --balls says otherwise. */
+        META_MAX_BALLS = 4096,        /**< Most metaballs the float kernels can sum. */
+        META_TILE = 32,               /**< Columns per culling tile. */
+        META_LANES = 16,              /**< Balls the widest kernel sums at once. */
+};
+
+/* Ball positions and velocities, an array of n per coordinate. */
+struct metaballs {
+        int n;
+        double *x, *y, *dx, *dy;              /* Each on its own cache line */
+        float *fx, *fy;                       /* x and y in float, for the kernels */
+};
+
+extern struct metaballs global_balls;
+extern int meta_balls;                  /* Balls meta_renderer.init() makes */
+
+/* Balls worth summing over one tile of pixels, see meta_tile_alloc(). */
+struct meta_tile {
+        int n_near;
+        int *near;                            /* Ascending ball indices */
+        double far_bound;                     /* Most the other balls can add */
+        double far_lower;                     /* Least the other balls add */
+        double lit_sum;                       /* A near sum over this is lit */
+        /* For the vector kernels: x of the near balls from origin_x in
+         * float, and a float sum over lit_limit is lit, at most
+         * dark_limit dark. */
+        double origin_x;
+        float lit_limit, dark_limit;
+        int vector;                           /* Float is exact enough here */
+        float *near_x;
+        float *dy2;                           /* Kernels' scratch, a row's dy^2 */
+        int capacity;                         /* Balls near, near_x and dy2 have room for */
+};
+
+void paint_meta_pixel(struct pixel *pixel, double x, double y);
+void meta_update(int first, struct damage *damage,
+                 int32_t width, int32_t height,
+                 double max_xx, double max_yy);
+void meta_tile_alloc(struct meta_tile *tile);
+void meta_tile_free(struct meta_tile *tile);
+void meta_tile_init(struct meta_tile *tile,
+                    double x0, double y0, double x1, double y1);
+void meta_paint_span(const struct meta_tile *tile,
+                     struct pixel *row, int32_t x0, int32_t x1,
+                     const double *xs, double y);
+
+/* Render workers */
+typedef void (*worker_task_fn)(void *ctx, int task);
+
+struct worker_pool *worker_pool_create(int n_workers);
+void                worker_pool_destroy(struct worker_pool *pool);
+int                 worker_pool_size(struct worker_pool *pool);
+void                worker_pool_run(struct worker_pool *pool,
+                                    int n_tasks,
+                                    worker_task_fn task,
+                                    void *ctx);
 
 #endif /* SIMPLE_H_ */
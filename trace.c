@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <wayland-client.h>
+#include "simple.h"
+
+/*
+ * Frame timing.
+ *
+ * draw() stamps each stage of a frame (see struct frame_trace) and the
+ * intervals between stages go into log-linear histograms in the style of
+ * HdrHistogram: values are bucketed by power of two, and each power of two
+ * is split into 2^HIST_SUB_BITS linear sub-buckets, which keeps every
+ * bucket within ~3% of the value it holds while covering 1ns to hours.
+ *
+ * Everything is gated on trace_enabled so a disabled trace costs one
+ * branch per stage.
+ */
+
+enum {
+        HIST_SUB_BITS = 5,
+        HIST_SUB_COUNT = 1 << HIST_SUB_BITS,
+        HIST_BUCKETS = (64 - HIST_SUB_BITS + 1) * HIST_SUB_COUNT,
+};
+
+struct histogram {
+        uint64_t count;
+        uint64_t min, max;
+        uint64_t buckets[HIST_BUCKETS];
+};
+
+int trace_enabled;
+
+static struct histogram histograms[N_TRACE_HISTS];
+
+static const char *const hist_names[N_TRACE_HISTS] = {
+        [TRACE_FRAME_INTERVAL] = "callback to callback",
+        [TRACE_WAIT_BUFFER]    = "callback to buffer",
+        [TRACE_RENDER]         = "render",
+        [TRACE_SUBMIT]         = "render end to commit",
+        [TRACE_FRAME]          = "callback to commit",
+        [TRACE_HELD]           = "commit to release",
+        [TRACE_PRESENT]        = "commit to present",
+};
+
+uint64_t trace_now(void)
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static int hist_index(uint64_t value)
+{
+        int msb;
+
+        if (value < HIST_SUB_COUNT)
+                return value;
+
+        msb = 63 - __builtin_clzll(value);
+        return (msb - HIST_SUB_BITS + 1) * HIST_SUB_COUNT
+                + ((value >> (msb - HIST_SUB_BITS)) & (HIST_SUB_COUNT - 1));
+}
+
+/* Smallest value that lands in bucket index. */
+static uint64_t hist_value(int index)
+{
+        int shift;
+
+        if (index < HIST_SUB_COUNT)
+                return index;
+
+        shift = index / HIST_SUB_COUNT - 1;
+        return (uint64_t)(HIST_SUB_COUNT + index % HIST_SUB_COUNT) << shift;
+}
+
+void trace_interval(enum trace_hist hist, uint64_t start, uint64_t end)
+{
+        struct histogram *h = &histograms[hist];
+        uint64_t value;
+
+        if (!start || end < start)
+                return;
+
+        value = end - start;
+        if (!h->count || value < h->min)
+                h->min = value;
+        if (value > h->max)
+                h->max = value;
+        h->count++;
+        h->buckets[hist_index(value)]++;
+}
+
+/**
+ * Record the intervals between the stages of one frame.
+ */
+void trace_frame(const struct frame_trace *t)
+{
+        static uint64_t last_callback;
+
+        trace_interval(TRACE_FRAME_INTERVAL, last_callback, t->callback);
+        trace_interval(TRACE_WAIT_BUFFER, t->callback, t->acquire);
+        trace_interval(TRACE_RENDER, t->render_start, t->render_end);
+        trace_interval(TRACE_SUBMIT, t->render_end, t->commit);
+        trace_interval(TRACE_FRAME, t->callback, t->commit);
+        last_callback = t->callback;
+}
+
+static uint64_t hist_percentile(const struct histogram *h, double percentile)
+{
+        uint64_t want = h->count * percentile / 100.0, seen = 0;
+        int i;
+
+        for (i = 0; i < HIST_BUCKETS; i++) {
+                seen += h->buckets[i];
+                /* Report the top of the bucket, like HdrHistogram. */
+                if (seen > want)
+                        return i + 1 < HIST_BUCKETS && hist_value(i + 1) - 1 < h->max
+                                ? hist_value(i + 1) - 1 : h->max;
+        }
+        return h->max;
+}
+
+/**
+ * Print a line of percentiles (in microseconds) for every histogram.
+ */
+void trace_dump(FILE *out)
+{
+        int i;
+
+        fprintf(out, "%-22s %8s %9s %9s %9s %9s %9s %9s\n",
+                "interval (us)", "count", "min", "p50", "p90", "p99", "p99.9", "max");
+
+        for (i = 0; i < N_TRACE_HISTS; i++) {
+                const struct histogram *h = &histograms[i];
+
+                if (!h->count)
+                        continue;
+                fprintf(out, "%-22s %8" PRIu64 " %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n",
+                        hist_names[i], h->count,
+                        h->min / 1e3,
+                        hist_percentile(h, 50) / 1e3,
+                        hist_percentile(h, 90) / 1e3,
+                        hist_percentile(h, 99) / 1e3,
+                        hist_percentile(h, 99.9) / 1e3,
+                        h->max / 1e3);
+        }
+        fflush(out);
+}
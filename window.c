@@ -49,12 +49,21 @@ struct my_window *create_window(struct my_display *display, int width, int heigh
 
     window->callback = NULL;
     window->display = display;
+    display->window = window;
     window->width = width;
     window->height = height;
     window->min_width = width;
     window->min_height = height;
+    window->max_buffers = DEFAULT_BUFFERS;
+    window->refresh_ns = REFRESH_NS;
+    window->scale = SCALE_ONE;
+    window->dest_width = window->dest_height = -1;
+    window->workers = worker_pool_create(0);
+    render_thread_start(window);
     
     window->surface = wl_compositor_create_surface(display->compositor);
+    if (display->viewporter)
+        window->viewport = wp_viewporter_get_viewport(display->viewporter, window->surface);
 
     if (display->xdg_shell) {
         window->xdg_surface = xdg_shell_get_xdg_surface(display->xdg_shell, window->surface);
@@ -84,37 +93,50 @@ void destroy_window(struct my_window *window)
 {
     int i;
 
+    render_thread_stop(window);
+
     if (window->callback) {
         wl_callback_destroy(window->callback);
         window->callback = NULL;
     }
 
 
-    for (i = 0; i < BUFFERS; i++) {
+    for (i = 0; i < window->n_buffers; i++) {
         if (window->buffers[i].buffer != NULL) {
             wl_buffer_destroy(window->buffers[i].buffer);
             window->buffers[i].buffer = NULL;
         }
     }
+    if (window->retired) {
+        wl_buffer_destroy(window->retired);
+        window->retired = NULL;
+    }
 
     if (window->shm_pool) {
         wl_shm_pool_destroy(window->shm_pool);
-        munmap(window->shm_data,
-               window->display->width *
-               window->display->height * 4 * BUFFERS);
-        // remove(window->shm_fname);
-        free(window->shm_fname);
-        window->shm_fname = NULL;
+        shm_destroy(&window->shm);
         window->shm_pool = NULL;
     }
 
+    if (window->workers) {
+        worker_pool_destroy(window->workers);
+        window->workers = NULL;
+    }
+
     if (window->shell_surface) {
         wl_shell_surface_destroy(window->shell_surface);
         window->shell_surface = NULL;
     }
 
+    if (window->viewport) {
+        wp_viewport_destroy(window->viewport);
+        window->viewport = NULL;
+    }
+
     wl_surface_destroy(window->surface);
     window->surface = NULL;
+    if (window->display->window == window)
+        window->display->window = NULL;
     free(window);
 }
 
@@ -139,6 +161,7 @@ static void shell_surface_configure(void *data,
 
     window->width = MAX(window->min_width, MIN(width, window->display->width));
     window->height = MAX(window->min_height, MIN(height, window->display->height));
+    redraw(window);
 }
 
 /* Stub for pop up handling. */
@@ -160,6 +183,7 @@ static void xdg_surface_configure(void *data,
 
     window->width = MAX(window->min_width, MIN(width, window->display->width));
     window->height = MAX(window->min_width, MIN(height, window->display->height));
+    redraw(window);
 }
 static void xdg_surface_delete(void* data,
                                struct xdg_surface *xdg_surface)
@@ -0,0 +1,211 @@
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include <wayland-client.h>
+#include "simple.h"
+
+/*
+ * Persistent pool of render threads.
+ *
+ * A job is split into `n_tasks` independent tasks (row bands of the frame
+ * buffer). Each worker is handed a contiguous run of task indices as its own
+ * queue. Once a worker drains its own queue it steals from the other workers'
+ * queues, so slow regions (the inside of the mandelbrot set) get spread over
+ * every core instead of leaving one thread to finish alone.
+ *
+ * Taking a task is a single atomic fetch-add on the queue's `next` index,
+ * owners and thieves use the same operation so no task is run twice.
+ */
+
+struct worker_queue {
+        atomic_int next;
+        int end;
+} __attribute__((aligned(CACHE_LINE)));
+
+struct worker {
+        struct worker_pool *pool;
+        int id;
+        pthread_t thread;
+};
+
+struct worker_pool {
+        int n_workers;
+        struct worker *workers;
+        struct worker_queue *queues;
+
+        pthread_mutex_t lock;
+        pthread_cond_t start;       /* Signaled when a new job is posted. */
+        pthread_cond_t done;        /* Signaled when the last worker finishes. */
+        unsigned generation;        /* Incremented for each job. */
+        int pending;                /* Workers still busy on the current job. */
+        int quit;
+
+        worker_task_fn task;
+        void *ctx;
+};
+
+/* Run tasks from queue until it is empty. */
+static void drain_queue(struct worker_pool *pool, struct worker_queue *queue)
+{
+        int i;
+
+        while ((i = atomic_fetch_add(&queue->next, 1)) < queue->end)
+                pool->task(pool->ctx, i);
+}
+
+static void *worker_main(void *data)
+{
+        struct worker *worker = data;
+        struct worker_pool *pool = worker->pool;
+        unsigned seen = 0;
+        int i;
+
+        for (;;) {
+                pthread_mutex_lock(&pool->lock);
+                while (!pool->quit && pool->generation == seen)
+                        pthread_cond_wait(&pool->start, &pool->lock);
+                if (pool->quit) {
+                        pthread_mutex_unlock(&pool->lock);
+                        break;
+                }
+                seen = pool->generation;
+                pthread_mutex_unlock(&pool->lock);
+
+                /* Own work first, then steal starting at our neighbour. */
+                drain_queue(pool, &pool->queues[worker->id]);
+                for (i = 1; i < pool->n_workers; i++)
+                        drain_queue(pool,
+                                    &pool->queues[(worker->id + i) % pool->n_workers]);
+
+                pthread_mutex_lock(&pool->lock);
+                if (--pool->pending == 0)
+                        pthread_cond_signal(&pool->done);
+                pthread_mutex_unlock(&pool->lock);
+        }
+
+        return NULL;
+}
+
+/**
+ * Create a pool of `n_workers` threads. If `n_workers` is not positive
+ * the number of online CPUs is used.
+ */
+struct worker_pool *worker_pool_create(int n_workers)
+{
+        struct worker_pool *pool;
+        int i;
+
+        if (n_workers <= 0)
+                n_workers = sysconf(_SC_NPROCESSORS_ONLN);
+        if (n_workers <= 0)
+                n_workers = 1;
+
+        pool = calloc(1, sizeof *pool);
+        if (pool == NULL) {
+                perror(""); exit(1);
+        }
+
+        pool->n_workers = n_workers;
+        pool->workers = calloc(n_workers, sizeof *pool->workers);
+        if (posix_memalign((void **)&pool->queues, CACHE_LINE,
+                           n_workers * sizeof *pool->queues) != 0)
+                pool->queues = NULL;
+        if (pool->workers == NULL || pool->queues == NULL) {
+                perror(""); exit(1);
+        }
+        for (i = 0; i < n_workers; i++) {
+                atomic_init(&pool->queues[i].next, 0);
+                pool->queues[i].end = 0;
+        }
+
+        pthread_mutex_init(&pool->lock, NULL);
+        pthread_cond_init(&pool->start, NULL);
+        pthread_cond_init(&pool->done, NULL);
+
+        for (i = 0; i < n_workers; i++) {
+                pool->workers[i].pool = pool;
+                pool->workers[i].id = i;
+                if (pthread_create(&pool->workers[i].thread, NULL,
+                                   worker_main, &pool->workers[i]) != 0) {
+                        perror("Failed to start render thread");
+                        exit(1);
+                }
+        }
+
+        fprintf(stderr, "Started %d render threads\n", n_workers);
+
+        return pool;
+}
+
+void worker_pool_destroy(struct worker_pool *pool)
+{
+        int i;
+
+        pthread_mutex_lock(&pool->lock);
+        pool->quit = 1;
+        pthread_cond_broadcast(&pool->start);
+        pthread_mutex_unlock(&pool->lock);
+
+        for (i = 0; i < pool->n_workers; i++)
+                pthread_join(pool->workers[i].thread, NULL);
+
+        pthread_cond_destroy(&pool->done);
+        pthread_cond_destroy(&pool->start);
+        pthread_mutex_destroy(&pool->lock);
+        free(pool->queues);
+        free(pool->workers);
+        free(pool);
+}
+
+int worker_pool_size(struct worker_pool *pool)
+{
+        return pool->n_workers;
+}
+
+/**
+ * Run task(ctx, i) for every i in [0, n_tasks) on the pool and wait
+ * for all of them to finish.
+ */
+void worker_pool_run(struct worker_pool *pool,
+                     int n_tasks,
+                     worker_task_fn task,
+                     void *ctx)
+{
+        int i, per_worker, extra, start;
+
+        if (n_tasks <= 0)
+                return;
+
+        pthread_mutex_lock(&pool->lock);
+        assert(pool->pending == 0);
+
+        pool->task = task;
+        pool->ctx = ctx;
+
+        /* Deal tasks out in contiguous runs, neighbouring bands are likely
+         * to cost about the same. Stealing evens out the rest. */
+        per_worker = n_tasks / pool->n_workers;
+        extra = n_tasks % pool->n_workers;
+        start = 0;
+        for (i = 0; i < pool->n_workers; i++) {
+                int count = per_worker + (i < extra ? 1 : 0);
+                atomic_store(&pool->queues[i].next, start);
+                pool->queues[i].end = start + count;
+                start += count;
+        }
+        assert(start == n_tasks);
+
+        pool->pending = pool->n_workers;
+        pool->generation++;
+        pthread_cond_broadcast(&pool->start);
+
+        while (pool->pending > 0)
+                pthread_cond_wait(&pool->done, &pool->lock);
+        pthread_mutex_unlock(&pool->lock);
+}